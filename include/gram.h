@@ -5,6 +5,9 @@
 #define GRAM_DRAW_LINE (1 << 1)
 #define GRAM_DRAW_COL (1 << 2)
 
+/// `gram_update` only depends on `t`, so samples may be evaluated out of order and on several threads at once
+#define GRAM_FLAG_PURE (1 << 0)
+
 typedef struct gram_color {
     int r, g, b, a;
 } GramColor;
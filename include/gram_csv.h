@@ -7,6 +7,36 @@
 #define GRAMCSV_ERR_FILE_EMPTY 2
 #define GRAMCSV_ERR_IRREGULAR_FIELD_NUMBER 3
 #define GRAMCSV_ERR_READ_LINE 4
+#define GRAMCSV_ERR_BAD_CACHE 5
+#define GRAMCSV_ERR_NO_SUCH_COLUMN 6
+#define GRAMCSV_ERR_TRUNCATED 7
+#define GRAMCSV_ERR_COMPRESSION 8
+
+#define GRAMCSV_ERR_MSG_SZ 256
+
+/// how the values of a column are stored
+typedef enum GramCsvType {
+    GRAMCSV_TYPE_DOUBLE = 0,
+    GRAMCSV_TYPE_FLOAT,
+    GRAMCSV_TYPE_INT32,
+    /// text, stored as `uint32_t` indices into the column dictionary
+    GRAMCSV_TYPE_DICT,
+} GramCsvType;
+
+/// a column in the type it is stored as
+typedef struct GramCsvColumn {
+    GramCsvType type;
+    /// `double*`, `float*`, `int32_t*` or `uint32_t*` dictionary codes
+    void* data;
+    size_t dict_len;
+    char** dict;
+} GramCsvColumn;
+
+/// stores the column `name` as `type` no matter what its values look like
+typedef struct GramCsvTypeHint {
+    const char* name;
+    GramCsvType type;
+} GramCsvTypeHint;
 
 typedef struct CSVFile {
     char* file_name;
@@ -14,16 +44,159 @@ typedef struct CSVFile {
     char** headers;
     size_t col_count;
     size_t col_len;
+    /// `columns[c]` is NULL for columns that are not stored as doubles,
+    /// `gram_csv_value` and `gram_csv_read_column` read every column type
     double** columns;
+    /// storage of every column, NULL if all of them are plain doubles
+    GramCsvColumn* typed;
+    /// set when the columns point into a mapped column cache instead of owning their memory
+    void* map;
+    size_t map_len;
+    /// single allocation holding everything above (but a mapped cache),
+    /// NULL if the parts were allocated one by one
+    void* mem;
 } CSVFile;
 
 typedef char** line_t;
 
+/// holds everything a load needs besides the file itself,
+/// separate parsers can be used from separate threads at the same time
+typedef struct GramCsvParser {
+    /// upper bound of threads a single load may use, 0 picks one per core
+    /// (or the value of the `GRAMCSV_THREADS` environment variable)
+    size_t threads;
+    /// names of the only columns a load keeps (in the order of the file), fields of the other
+    /// columns are skipped without being converted. NULL (or a zero count) keeps every column
+    const char* const* select;
+    size_t select_count;
+    /// store numeric columns in the narrowest of int32, float32 and double that holds every value
+    /// exactly, and columns of text as dictionaries. Text columns are told apart by the first records.
+    /// 0 stores every column as doubles (text reads as 0)
+    int infer_types;
+    /// types of particular columns, taking precedence over inference. Values are converted
+    /// to the hinted type (int32 truncates), hints for columns that are not loaded are ignored
+    const GramCsvTypeHint* hints;
+    size_t hint_count;
+    /// message of the last failed load, empty after a successful one
+    char err[GRAMCSV_ERR_MSG_SZ];
+} GramCsvParser;
+
+/// how `gram_csv_write_header` stores the values
+typedef enum GramCsvHeaderMode {
+    /// decimal initializers with 6 digits after the point
+    GRAMCSV_HEADER_TEXT = 0,
+    /// exact hexadecimal float initializers
+    GRAMCSV_HEADER_HEX,
+    /// the raw doubles in a file next to the header, pulled in with `#embed` (or `.incbin`
+    /// where that is missing), so the compiler never parses the values
+    GRAMCSV_HEADER_BLOB,
+} GramCsvHeaderMode;
+
+/// up to `rows` consecutive records of a csv file, stored column by column
+typedef struct GramCsvBatch {
+    size_t header_count;
+    char** headers;
+    /// index of the first row of the batch within the whole file
+    size_t first_row;
+    size_t rows;
+    /// `columns[c][0..rows)`, only valid until the callback returns
+    double** columns;
+    /// how far into the file the stream got with this batch (into the decompressed text for compressed files)
+    size_t bytes_read;
+    /// size of the file, 0 for compressed files whose decompressed size is not known up front
+    size_t file_size;
+} GramCsvBatch;
+
+/// a csv file that is still being appended to. Only complete records are parsed,
+/// a partial last line is held back until the rest of it has been written
+typedef struct GramCsvFollow {
+    /// every complete record read so far, stored as doubles. The columns grow in place,
+    /// so pointers into them are only valid until the next poll
+    CSVFile csv;
+    /// rows the columns have room for
+    size_t cap;
+    /// bytes of the file that have been parsed
+    size_t offset;
+    int fd;
+    /// fields per record of the file and which of them are kept (NULL keeps all)
+    size_t field_count;
+    unsigned char* keep;
+    /// lines before `offset`, for error positions
+    size_t line_count;
+    /// bytes read past `offset`, reused between polls
+    char* buf;
+    size_t buf_sz;
+} GramCsvFollow;
+
+/// receives every batch of a stream, returning non zero stops it
+typedef int (*gram_csv_batch_fn)(const GramCsvBatch* batch, void* user);
+
+void gram_csv_parser_init(GramCsvParser* parser);
+/// gzip and zstd compressed files (told apart by their magic bytes) are decompressed on a
+/// separate thread while they are parsed, in the load functions below as well.
+/// Returns 0 if no error
+int gram_csv_parser_load(GramCsvParser* parser, const char* csv_file, CSVFile* ret);
+/// parses the file without keeping it in memory, handing batches of up to `batch_rows`
+/// rows (0 for a default) to `fn`. Batches always hold doubles, types are only used by loads. Already parsed parts of the file are dropped from memory
+/// as the stream goes on. Returns 0 if no error (or if `fn` stopped the stream)
+int gram_csv_parser_stream(GramCsvParser* parser, const char* csv_file, size_t batch_rows,
+    gram_csv_batch_fn fn, void* user);
+/// maps a column cache written by `gram_csv_write_cache`, the columns are not copied
+/// out of the mapping, returns 0 if no error
+int gram_csv_parser_load_cache(GramCsvParser* parser, const char* cache_file, CSVFile* ret);
+/// loads the column cache of `csv_file` if there is one that is newer than the file itself
+/// and holds its columns in types the settings of `parser` allow (hinted columns as hinted,
+/// the rest as doubles unless `infer_types` is set, which takes the cached types as they are),
+/// parses `csv_file` otherwise, returns 0 if no error
+int gram_csv_parser_load_cached(GramCsvParser* parser, const char* csv_file, CSVFile* ret);
+/// loads the complete records of a file that is still being written to (honouring the
+/// selection of the parser, but always as doubles) and keeps it open for
+/// `gram_csv_follow_poll`, returns 0 if no error
+int gram_csv_parser_follow(GramCsvParser* parser, const char* csv_file, GramCsvFollow* follow);
+/// appends the records completed since the last poll to `follow->csv`, only the new bytes
+/// are read. `*rows` is set to the number of rows appended. Returns 0 if no error,
+/// `GRAMCSV_ERR_TRUNCATED` if the file got shorter (it has to be followed anew then)
+int gram_csv_follow_poll(GramCsvParser* parser, GramCsvFollow* follow, size_t* rows);
+void gram_csv_follow_free(GramCsvFollow* follow);
+/// returns a pointer to the error message of the last load done with `parser`
+const char* gram_csv_parser_err_msg(const GramCsvParser* parser);
+
+/// same as `gram_csv_parser_load` with a parser private to the calling thread,
 /// returns 0 if no error
 int gram_csv_load_csv(const char* csv_file, CSVFile* ret);
 void gram_csv_csv_file_free(CSVFile csv);
+/// same as `gram_csv_write_header` in `GRAMCSV_HEADER_TEXT` mode
 void gram_csv_write_header_file(CSVFile* csv, const char* header_file);
-/// returns a pointer to the error message (do not attempt to free this pointer)
+/// writes the columns as a C header defining a struct with the row and column count,
+/// the range (`min`/`max`) of every column and the values. Returns 0 if no error
+int gram_csv_write_header(CSVFile* csv, const char* header_file, GramCsvHeaderMode mode);
+/// path of the blob written next to a header in `GRAMCSV_HEADER_BLOB` mode
+/// (`data.h` -> `data.bin`), free it after use
+char* gram_csv_blob_path(const char* header_file);
+/// writes the source of a `gram` plugin serving the columns from static memory (one
+/// dimension per column, one sample per row) to `plugin_file` (`data.c`), along with its
+/// data header (`data_data.h`, values stored as `mode` says) and a CMake snippet adding
+/// it as a SHARED target (`data.cmake`). Returns 0 if no error
+int gram_csv_write_plugin(CSVFile* csv, const char* plugin_file, GramCsvHeaderMode mode);
+/// path of a file written next to a plugin source, `plugin_file` with its `.c` replaced
+/// by `suffix` (`data.c`, `_data.h` -> `data_data.h`), free it after use
+char* gram_csv_plugin_path(const char* plugin_file, const char* suffix);
+/// writes the columns into the binary column cache format (`.gramcol`), returns 0 if no error
+int gram_csv_write_cache(CSVFile* csv, const char* cache_file);
+/// returns the column cache path of a csv file (`data.csv` or `data.csv.gz` -> `data.gramcol`), free it after use
+char* gram_csv_cache_path(const char* csv_file);
+/// storage type of column `col`
+GramCsvType gram_csv_column_type(const CSVFile* csv, size_t col);
+/// value of a cell widened to a double, dictionary cells give their index into the dictionary
+double gram_csv_value(const CSVFile* csv, size_t col, size_t row);
+/// text of a dictionary cell, NULL if the column is not stored as a dictionary
+const char* gram_csv_text(const CSVFile* csv, size_t col, size_t row);
+/// smallest and largest value of column `col` (0 for both if it is empty)
+void gram_csv_column_range(const CSVFile* csv, size_t col, double* min, double* max);
+/// widens `n` values of column `col` starting at `row` into `out`
+void gram_csv_read_column(const CSVFile* csv, size_t col, size_t row, size_t n, double* out);
+/// returns a pointer to the error message of the last `gram_csv_load_csv` on this thread
+/// (do not attempt to free this pointer)
 const char* gram_csv_err_msg();
 
 
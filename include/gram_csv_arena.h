@@ -0,0 +1,26 @@
+#ifndef GRAM_CSV_ARENA_H
+#define GRAM_CSV_ARENA_H
+#include <stddef.h>
+
+typedef struct csv_arena_block csv_arena_block_t;
+
+/// bump allocator handing out memory from large blocks that are only given back all at once
+typedef struct {
+    csv_arena_block_t* head;
+    size_t block_sz;
+} csv_arena_t;
+
+void csv_arena_init(csv_arena_t* arena, size_t block_sz);
+/// returns `size` bytes aligned to `align` (a power of two up to 64), never NULL
+void* csv_arena_alloc(csv_arena_t* arena, size_t size, size_t align);
+char* csv_arena_strdup(csv_arena_t* arena, const char* str);
+/// makes all of the memory available again, keeping only the most recent block
+void csv_arena_reset(csv_arena_t* arena);
+void csv_arena_free(csv_arena_t* arena);
+/// hands the memory of an arena that fit in a single block over to the caller,
+/// everything allocated from it is released with one `free` of the returned pointer
+void* csv_arena_release(csv_arena_t* arena);
+/// bytes to ask for so that allocations of `size` and `align` fit in an arena of that size
+size_t csv_arena_need(size_t size, size_t align);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef GRAM_CSV_COLUMN_H
+#define GRAM_CSV_COLUMN_H
+#include <stddef.h>
+#include <stdint.h>
+#include "gram_csv.h"
+
+/// a typed column while it is being parsed. Numeric columns that are not `fixed`
+/// start out as int32 and are widened in place once a value does not fit anymore
+typedef struct {
+    GramCsvType type;
+    /// the type was picked up front and values are converted to it instead
+    int fixed;
+    size_t rows;
+    size_t cap;
+    void* data;
+    /// largest magnitude stored as int32, float32 only holds integers up to 2^24 exactly
+    uint32_t int_max;
+    size_t dict_len;
+    size_t dict_cap;
+    char** dict;
+    uint64_t* dict_hash;
+    /// open addressing table of dictionary codes + 1, 0 marks a free slot
+    size_t slots_sz;
+    uint32_t* slots;
+} csv_column_t;
+
+/// bytes per value stored as `type`
+size_t csv_type_size(GramCsvType type);
+void csv_column_init(csv_column_t* col, GramCsvType type, int fixed);
+void csv_column_free(csv_column_t* col);
+void csv_column_push_number(csv_column_t* col, double v);
+void csv_column_push_text(csv_column_t* col, const char* str, size_t len);
+/// moves the parts of one column (in row order) into `out` widened to the type they all fit in
+void csv_column_merge(GramCsvColumn* out, csv_column_t* parts, size_t n);
+/// whether `str[0..len)` reads as a number as far as type inference is concerned
+int csv_is_number(const char* str, size_t len);
+
+#endif
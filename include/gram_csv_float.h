@@ -0,0 +1,10 @@
+#ifndef GRAM_CSV_FLOAT_H
+#define GRAM_CSV_FLOAT_H
+#include <stddef.h>
+
+/// converts the number at the start of `str[0..len)` the same way `strtod` does in the "C" locale
+/// (correctly rounded, trailing characters are ignored, 0.0 if there is no number),
+/// `str` does not have to be NUL terminated
+double gram_csv_parse_double(const char* str, size_t len);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef GRAM_CSV_INFLATE_H
+#define GRAM_CSV_INFLATE_H
+#include <stddef.h>
+
+typedef enum {
+    CSV_PLAIN = 0,
+    CSV_GZIP,
+    CSV_ZSTD,
+} csv_compression_t;
+
+/// a compressed file decompressed block by block on a thread of its own
+typedef struct csv_inflate csv_inflate_t;
+
+/// tells compressed input apart from plain text by its magic bytes
+csv_compression_t csv_compression(const char* data, size_t len);
+/// name of the format for error messages
+const char* csv_compression_name(csv_compression_t kind);
+/// whether the library was built with a decoder for `kind`
+int csv_inflate_supported(csv_compression_t kind);
+/// starts decompressing `data[0..len)` on a new thread, the data has to stay valid until
+/// `csv_inflate_finish`. Returns NULL if `kind` is not supported or the thread could not be started
+csv_inflate_t* csv_inflate_start(const char* data, size_t len, csv_compression_t kind);
+/// waits for the next block of decompressed bytes, valid until the next call.
+/// Returns its length, 0 once everything was handed out
+size_t csv_inflate_next(csv_inflate_t* z, const char** block);
+/// stops decompressing (also in the middle of the data) and frees `z`,
+/// returns 0 if all of the data was decompressed and it was intact
+int csv_inflate_finish(csv_inflate_t* z);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef GRAM_CSV_SCAN_H
+#define GRAM_CSV_SCAN_H
+#include <stddef.h>
+#include <stdint.h>
+
+#define GRAMCSV_SCAN_BLOCK 64
+
+/// structural character iterator over a csv buffer.
+/// Finds `,`, `\r` and `\n` outside of quoted fields and every `"`,
+/// one 64 byte block at a time.
+typedef struct {
+    const char* block;
+    const char* end;
+    /// structural characters of the current block that were not returned yet
+    uint64_t bits;
+    /// all ones if the previous block ended inside of a quoted field
+    uint64_t quote_carry;
+} csv_scanner_t;
+
+/// `in_quote` tells whether `begin` lies inside of a quoted field
+void csv_scanner_init(csv_scanner_t* s, const char* begin, const char* end, int in_quote);
+/// classifies the current block (used by `csv_scanner_next`)
+void csv_scanner_load(csv_scanner_t* s);
+/// returns the number of `"` in `begin..end`
+size_t csv_count_quotes(const char* begin, const char* end);
+/// returns the name of the block classifier in use ("avx2", "sse2" or "scalar"),
+/// setting `GRAMCSV_SCAN=scalar` in the environment forces the scalar one
+const char* csv_scanner_impl(void);
+
+/// returns a pointer to the next structural character or `end`
+static inline const char* csv_scanner_next(csv_scanner_t* s)
+{
+    while (!s->bits) {
+        s->block += GRAMCSV_SCAN_BLOCK;
+        if (s->block >= s->end) {
+            s->block = s->end;
+            return s->end;
+        }
+        csv_scanner_load(s);
+    }
+    const char* p = s->block + __builtin_ctzll(s->bits);
+    s->bits &= s->bits - 1;
+    return p;
+}
+
+#endif
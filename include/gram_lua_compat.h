@@ -0,0 +1,79 @@
+#ifndef GRAM_LUA_COMPAT_H
+#define GRAM_LUA_COMPAT_H
+#include <lauxlib.h>
+#include <lua.h>
+
+// the sources are written against Lua 5.4, this maps the parts they use onto the 5.1 API of
+// LuaJIT (which has the 5.2 additions `lua_tointegerx` and `luaL_setmetatable` on top)
+#if LUA_VERSION_NUM < 503
+
+#ifndef LUA_OK
+#define LUA_OK 0
+#endif
+
+#define lua_rawlen lua_objlen
+
+static inline int gram_lua_getglobal(lua_State* l, const char* name)
+{
+    lua_getfield(l, LUA_GLOBALSINDEX, name);
+    return lua_type(l, -1);
+}
+#undef lua_getglobal
+#define lua_getglobal gram_lua_getglobal
+
+static inline int gram_lua_rawgeti(lua_State* l, int idx, int n)
+{
+    lua_rawgeti(l, idx, n);
+    return lua_type(l, -1);
+}
+#define lua_rawgeti gram_lua_rawgeti
+
+/// numbers without a fractional part, 5.1 has no separate integer type
+static inline int lua_isinteger(lua_State* l, int idx)
+{
+    if (lua_type(l, idx) != LUA_TNUMBER)
+        return 0;
+    lua_Number n = lua_tonumber(l, idx);
+    return n == (lua_Number)(lua_Integer)n;
+}
+
+/// same as in 5.4, unlike the LuaJIT one which truncates
+static inline lua_Integer gram_lua_tointegerx(lua_State* l, int idx, int* isnum)
+{
+    lua_Number n = lua_tonumber(l, idx);
+    int ok = lua_isnumber(l, idx) && n == (lua_Number)(lua_Integer)n;
+    if (isnum)
+        *isnum = ok;
+    return ok ? (lua_Integer)n : 0;
+}
+#define lua_tointegerx gram_lua_tointegerx
+
+// a single user value, kept in the environment table of the userdata
+#define lua_newuserdatauv(l, size, nuv) lua_newuserdata(l, size)
+
+static inline int lua_setiuservalue(lua_State* l, int idx, int n)
+{
+    if (idx < 0 && idx > LUA_REGISTRYINDEX)
+        idx = lua_gettop(l) + idx + 1;
+    lua_createtable(l, n, 0);
+    lua_insert(l, -2);
+    lua_rawseti(l, -2, n);
+    return lua_setfenv(l, idx);
+}
+
+static inline int lua_getiuservalue(lua_State* l, int idx, int n)
+{
+    lua_getfenv(l, idx);
+    if (!lua_istable(l, -1)) {
+        lua_pop(l, 1);
+        lua_pushnil(l);
+        return LUA_TNIL;
+    }
+    lua_rawgeti(l, -1, n);
+    lua_remove(l, -2);
+    return lua_type(l, -1);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef GRAM_LUA_HEAP_H
+#define GRAM_LUA_HEAP_H
+#include <lua.h>
+#include <stddef.h>
+
+/// memory of a lua state: small blocks come from per size class free lists carved out of
+/// big chunks, bigger ones from malloc. Not thread safe, one heap per state
+typedef struct GramLuaHeap GramLuaHeap;
+
+typedef struct GramLuaHeapStats {
+    /// blocks handed out and given back since the heap was made
+    size_t allocs;
+    size_t frees;
+    /// allocations served from the size class pools
+    size_t pooled;
+    /// bytes in blocks that are in use, and the most there ever were
+    size_t bytes;
+    size_t peak_bytes;
+    /// garbage collection cycles seen by `gram_lua_heap_watch`
+    size_t collections;
+} GramLuaHeapStats;
+
+GramLuaHeap* gram_lua_heap_new(void);
+/// `lua_Alloc` with the heap as `ud`
+void* gram_lua_heap_alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+/// a new state allocating from `heap`. Builds of LuaJIT that refuse custom allocators
+/// (64 bit without GC64) get a state using their own, the heap then stays empty
+lua_State* gram_lua_heap_state(GramLuaHeap* heap);
+/// rewinds the chunks so the next state starts out on contiguous memory. Only done once every
+/// block has been given back (after `lua_close`), the chunks are kept for the next state
+void gram_lua_heap_reset(GramLuaHeap* heap);
+/// counts the garbage collection cycles of `l` (a state allocating from `heap`) from now on
+void gram_lua_heap_watch(GramLuaHeap* heap, lua_State* l);
+void gram_lua_heap_stats(const GramLuaHeap* heap, GramLuaHeapStats* stats);
+void gram_lua_heap_free(GramLuaHeap* heap);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef GRAM_POOL_H
+#define GRAM_POOL_H
+#include <stddef.h>
+
+/// threads that run the tasks of one job at a time, the thread starting the job helps
+typedef struct GramPool GramPool;
+
+/// runs `task` (in `0..tasks`) on `worker` (in `0..gram_pool_threads`), no two tasks
+/// run on the same worker at once
+typedef void (*gram_pool_fn)(void* arg, size_t task, size_t worker);
+
+/// starts `threads - 1` threads, returns NULL if none could be started
+GramPool* gram_pool_new(size_t threads);
+/// threads running tasks, the calling one included
+size_t gram_pool_threads(const GramPool* pool);
+/// runs `fn` for every task in `0..tasks` and returns when all of them are done
+void gram_pool_run(GramPool* pool, size_t tasks, gram_pool_fn fn, void* arg);
+void gram_pool_free(GramPool* pool);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef GRAM_SERIES_H
+#define GRAM_SERIES_H
+#include <stddef.h>
+#include <string.h>
+
+/// how the samples are laid out in `GramSeries.data`
+typedef enum GramSeriesLayout {
+    /// the dimensions of a sample next to each other, `data[t * dim + d]`
+    GRAM_SERIES_ROWS = 0,
+    /// one array per dimension, `data[d * time_cap + t]`
+    GRAM_SERIES_COLUMNS,
+} GramSeriesLayout;
+
+/// every sample of every dimension in one aligned buffer
+typedef struct GramSeries {
+    float* data;
+    size_t time;
+    size_t dim;
+    /// samples there is room for in every dimension
+    size_t time_cap;
+    /// floats allocated
+    size_t cap;
+    GramSeriesLayout layout;
+} GramSeries;
+
+/// makes room for `time` zeroed samples of `dim` dimensions, the buffer is only
+/// reallocated if it is too small
+void gram_series_reset(GramSeries* s, size_t time, size_t dim, GramSeriesLayout layout);
+/// changes the number of samples, the values of those that stay are kept and new ones are zeroed
+void gram_series_set_time(GramSeries* s, size_t time);
+/// makes `dst` a copy of `src`, its buffer is only reallocated if it is smaller than the one of `src`
+void gram_series_copy(GramSeries* dst, const GramSeries* src);
+void gram_series_free(GramSeries* s);
+/// widens `*min`/`*max` to the values of the samples `from..to`, NaN values are skipped
+void gram_series_range(const GramSeries* s, size_t from, size_t to, float* min, float* max);
+/// spreads the `time` samples evenly over `columns` columns and widens the range of every column,
+/// `min[c * dim + d]`/`max[c * dim + d]`, to the values of the samples `from..to` in it. NaN values are skipped
+void gram_series_envelope(const GramSeries* s, size_t from, size_t to, size_t columns, float* min, float* max);
+/// returns the name of the range reduction in use ("avx", "sse" or "scalar"),
+/// setting `GRAM_RANGE=scalar` in the environment forces the scalar one
+const char* gram_series_impl(void);
+
+static inline float gram_series_get(const GramSeries* s, size_t t, size_t d)
+{
+    return s->layout == GRAM_SERIES_ROWS ? s->data[t * s->dim + d] : s->data[d * s->time_cap + t];
+}
+
+/// the values of sample `t`, only in `GRAM_SERIES_ROWS` layout
+static inline float* gram_series_row(GramSeries* s, size_t t)
+{
+    return &s->data[t * s->dim];
+}
+
+/// copies the `dim` values of sample `t` to `values`
+static inline void gram_series_load(const GramSeries* s, size_t t, float* values)
+{
+    if (s->layout == GRAM_SERIES_ROWS) {
+        memcpy(values, &s->data[t * s->dim], s->dim * sizeof(float));
+        return;
+    }
+    for (size_t d = 0; d < s->dim; d++) {
+        values[d] = s->data[d * s->time_cap + t];
+    }
+}
+
+/// stores the `dim` values of sample `t` from `values`
+static inline void gram_series_store(GramSeries* s, size_t t, const float* values)
+{
+    if (s->layout == GRAM_SERIES_ROWS) {
+        memcpy(&s->data[t * s->dim], values, s->dim * sizeof(float));
+        return;
+    }
+    for (size_t d = 0; d < s->dim; d++) {
+        s->data[d * s->time_cap + t] = values[d];
+    }
+}
+
+#endif
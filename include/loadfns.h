@@ -1,6 +1,7 @@
 #ifndef LOADFNS_H
 #define LOADFNS_H
 #include "gram.h"
+#include "gram_csv.h"
 #include "stdlib.h"
 #include <lua.h>
 
@@ -18,6 +19,8 @@
 typedef struct {
     void* lib;
     _DEFINE_FN(void, gram_update, float, float*);
+    /// optional, evaluates `n` samples at once: sample `i` at time `t[i]` goes to `out[i * stride ..]`
+    _DEFINE_FN(void, gram_update_batch, const float*, size_t, float*, size_t);
     _DEFINE_FN(int, gram_get_draw_type);
     _DEFINE_FN(size_t, gram_get_time, void);
     _DEFINE_FN(int, gram_get_start_at, void);
@@ -26,9 +29,22 @@ typedef struct {
     _DEFINE_FN(GramColorScheme*, gram_get_color_scheme, void);
     _DEFINE_FN(void, gram_init, void);
     _DEFINE_FN(void, gram_fini, void);
+    /// optional, `GRAM_FLAG_*` describing the plugin
+    _DEFINE_FN(int, gram_get_flags, void);
+    /// optional, picks up data appended since the last call and returns how much of it there was
+    _DEFINE_FN(size_t, gram_poll, void);
+    /// optional, readies `workers` workers (worker 0 being the calling thread) to evaluate a pure
+    /// plugin at the same time, returns 0 if they cannot be. Only lua scripts need it, a state
+    /// can only be used by one thread at a time
+    _DEFINE_FN(int, gram_prepare_workers, size_t);
+    /// optional, makes the calling thread evaluate as `worker` from now on
+    _DEFINE_FN(void, gram_bind_worker, size_t);
 } GramExtFns;
 
 void load_from_so(const char*, GramExtFns*);
 void load_from_lua(const char* src, lua_State* l, GramExtFns* fns);
+/// pushes the table `Gram.load_csv` returns for `csv` (`fname`, `dim` and a read only view per
+/// header). The views take over the columns, `csv` is left empty and they are freed by `__gc`
+void make_csv_table(lua_State* l, CSVFile* csv);
 
 #endif
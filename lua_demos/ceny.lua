@@ -8,7 +8,7 @@ Colors = {
 local ceny;
 
 function Init()
-    ceny = Gram.load_csv("ceny.csv")
+    ceny = Gram.load_csv("ceny.csv", { "rok" })
     Time = #ceny.rok
     Dimensions = ceny.dim
 end
@@ -0,0 +1,32 @@
+-- with gram built against LuaJIT (-DGRAM_LUAJIT=ON) `UpdateBuffer` writes the samples
+-- through FFI pointers, other builds fall back to `UpdateRange`
+Time = 100000
+Dimensions = 2
+Draw = "line"
+Pure = true
+Colors = {
+    "orange",
+    "blue",
+}
+
+local sin, exp = math.sin, math.exp
+
+local function wave(t)
+    local x = t / 20000
+    return sin(x * 12) * exp(-x), sin(x * 12 + 1.5) * exp(-x)
+end
+
+-- `t` and `out` are `const float*` and `float*`, dimension `d` of sample `i`
+-- goes to `out[i * stride + d]` (counting from 0)
+function UpdateBuffer(t, n, out, stride)
+    for i = 0, n - 1 do
+        out[i * stride], out[i * stride + 1] = wave(t[i])
+    end
+end
+
+function UpdateRange(t, n, out)
+    local a, b = out[1], out[2]
+    for i = 1, n do
+        a[i], b[i] = wave(t[i])
+    end
+end
@@ -0,0 +1,23 @@
+-- run with `gram -l follow.lua -f`, rows appended to ceny.csv show up as they are written
+Time = 0
+Dimensions = 1
+Draw = "line"
+Colors = {
+    "orange",
+}
+
+local ceny;
+
+function Init()
+    ceny = Gram.follow_csv("ceny.csv", { "rok" })
+    Time = #ceny.rok
+end
+
+-- called with the number of rows appended to the followed files
+function Append(rows)
+    Time = #ceny.rok
+end
+
+function Update(t)
+    return ceny.rok[t+1] - 100
+end
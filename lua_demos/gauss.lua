@@ -1,13 +1,18 @@
 Time = 100
 Dimensions = 1
 Draw = "line"
+Pure = true
 Colors = {
     "blue",
 }
 
-function Update(t)
+function UpdateRange(t, n, out)
     local a = 10
     local b = 0.005
     local c = 0.1
-    return b * math.exp(c * t * (a - c * t))
+    local exp = math.exp
+    local y = out[1]
+    for i = 1, n do
+        y[i] = b * exp(c * t[i] * (a - c * t[i]))
+    end
 end
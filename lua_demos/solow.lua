@@ -82,10 +82,13 @@ end
 
 -- Labour productivity function plot for 3 countries: China, India & USA.
 -- Assuming that the USA is the base country (ie. K0_USA = 1, L0_USA = 1).
-function Update(t)
-    return {
-        [1] = fns.production(t, data.China) / fns.labour(t, data.China),
-        [2] = fns.production(t, data.India) / fns.labour(t, data.India),
-        [3] = fns.production(t, data.USA) / fns.labour(t, data.USA),
-    }
+-- The samples are handed over in order, so the recurrence can carry on from one to the next.
+function UpdateRange(t, n, out)
+    local china, india, usa = out[1], out[2], out[3]
+    for i = 1, n do
+        local x = t[i]
+        china[i] = fns.production(x, data.China) / fns.labour(x, data.China)
+        india[i] = fns.production(x, data.India) / fns.labour(x, data.India)
+        usa[i] = fns.production(x, data.USA) / fns.labour(x, data.USA)
+    end
 end
@@ -1,16 +1,23 @@
 Time = 100
 Dimensions = 3
 Draw = "line"
+-- samples only depend on `t`, so they can be evaluated on several threads at once,
+-- each with its own copy of this script
+Pure = true
 Colors = {
     "blue",
     "pink",
     "#f1f1f1"
 }
 
-function Update(t)
-    return {
-        [1] = math.sin(20 * t / Time),
-        [2] = math.cos(20 * t / Time),
-        [3] = math.atan(20 * t / Time),
-    }
+-- evaluates `n` samples per call instead of one, `out[d][i]` gets dimension `d`
+-- of the sample at time `t[i]` (`Update(t)` does the same one sample at a time).
+-- Values left unset keep what the sample held before, 0 for a new one
+function UpdateRange(t, n, out)
+    local sin, cos, atan = math.sin, math.cos, math.atan
+    local s, c, a = out[1], out[2], out[3]
+    for i = 1, n do
+        local x = 20 * t[i] / Time
+        s[i], c[i], a[i] = sin(x), cos(x), atan(x)
+    end
 end
@@ -1,57 +1,205 @@
 #include "gram_csv.h"
+#include <float.h>
 #include <plap.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #define PLAP_IMPLEMENTATION
 #include "plap.h"
 
-void print_csv(CSVFile* csv)
+#define PRINT_BATCH_ROWS 4096
+
+typedef struct {
+    const char* file_name;
+    size_t header_count;
+    char** headers;
+    size_t rows;
+    double* min;
+    double* max;
+    double* sum;
+} csv_summary_t;
+
+static int print_batch(const GramCsvBatch* batch, void* user)
 {
-    printf("gram_csv\n");
-    printf("CSV file: `%s`\n", csv->file_name);
-    printf("Fields per record: %ld\n", csv->header_count);
-    printf("Data per column: %ld\n", csv->col_len);
-    printf("Headers:\n");
-    for (size_t i = 0; i < csv->header_count; i++) {
-        printf("`%s`\t", csv->headers[i]);
-    }
-    printf("\n\n");
-    printf("Column Data:\n");
-    for (size_t i = 0; i < csv->col_len; i++) {
-        for (size_t c = 0; c < csv->col_count; c++) {
-            printf("%lf\t", csv->columns[c][i]);
+    csv_summary_t* s = user;
+    if (!s->min) {
+        printf("gram_csv\n");
+        printf("CSV file: `%s`\n", s->file_name);
+        printf("Fields per record: %zu\n", batch->header_count);
+        printf("Headers:\n");
+        for (size_t i = 0; i < batch->header_count; i++) {
+            printf("`%s`\t", batch->headers[i]);
+        }
+        printf("\n\n");
+        printf("Column Data:\n");
+        s->header_count = batch->header_count;
+        s->headers = calloc(batch->header_count, sizeof(char*));
+        for (size_t c = 0; c < batch->header_count; c++) {
+            s->headers[c] = strdup(batch->headers[c]);
+        }
+        s->min = calloc(batch->header_count, sizeof(double));
+        s->max = calloc(batch->header_count, sizeof(double));
+        s->sum = calloc(batch->header_count, sizeof(double));
+        for (size_t c = 0; c < batch->header_count; c++) {
+            s->min[c] = DBL_MAX;
+            s->max[c] = -DBL_MAX;
+        }
+    }
+    for (size_t i = 0; i < batch->rows; i++) {
+        for (size_t c = 0; c < batch->header_count; c++) {
+            double v = batch->columns[c][i];
+            printf("%lf\t", v);
+            s->min[c] = v < s->min[c] ? v : s->min[c];
+            s->max[c] = v > s->max[c] ? v : s->max[c];
+            s->sum[c] += v;
         }
         printf("\n");
     }
-    printf("\n");
+    s->rows += batch->rows;
+    return 0;
+}
+
+/// prints the file batch by batch so it never has to fit in memory, returns 0 if no error
+static int print_csv(GramCsvParser* parser, const char* path)
+{
+    const char* sep = strrchr(path, '/');
+    csv_summary_t s = { .file_name = sep ? sep + 1 : path };
+    int err = gram_csv_parser_stream(parser, path, PRINT_BATCH_ROWS, print_batch, &s);
+    if (!err) {
+        if (!s.min) {
+            printf("gram_csv\n");
+            printf("CSV file: `%s`\n", s.file_name);
+        }
+        printf("\n");
+        printf("Data per column: %zu\n", s.rows);
+        if (s.rows)
+            printf("Column summary (min / max / mean):\n");
+        for (size_t c = 0; s.rows && c < s.header_count; c++) {
+            printf("`%s`\t%lf\t%lf\t%lf\n", s.headers[c], s.min[c], s.max[c], s.sum[c] / s.rows);
+        }
+    }
+    for (size_t c = 0; c < s.header_count; c++) {
+        free(s.headers[c]);
+    }
+    free(s.headers);
+    free(s.min);
+    free(s.max);
+    free(s.sum);
+    return err;
+}
+
+static int is_cache_path(const char* path)
+{
+    const char* dot = strrchr(path, '.');
+    return dot && strcmp(dot, ".gramcol") == 0;
+}
+
+static void load(GramCsvParser* parser, const char* path, CSVFile* csv)
+{
+    if (gram_csv_parser_load(parser, path, csv)) {
+        fprintf(stderr, "%s\n", gram_csv_parser_err_msg(parser));
+        exit(-1);
+    }
+}
+
+/// header output format named on the command line
+static GramCsvHeaderMode header_mode(Option* format)
+{
+    if (!format || strcmp(format->str, "text") == 0)
+        return GRAMCSV_HEADER_TEXT;
+    if (strcmp(format->str, "hex") == 0)
+        return GRAMCSV_HEADER_HEX;
+    if (strcmp(format->str, "blob") == 0)
+        return GRAMCSV_HEADER_BLOB;
+    fprintf(stderr, "Unknown header format `%s` (expected text, hex or blob)\n", format->str);
+    exit(-1);
+}
+
+static void write_cache(CSVFile* csv, const char* path)
+{
+    if (gram_csv_write_cache(csv, path)) {
+        fprintf(stderr, "Could not write column cache `%s`\n", path);
+        exit(-1);
+    }
+    printf("Column cache written to `%s`\n", path);
 }
 
 int main(int argc, char** args)
 {
     ArgsDef adef = plap_args_def();
     plap_positional_string(&adef, "input-csv-file-path", "csv file to process", 1);
-    plap_positional_string(&adef, "output-header-file-path", "header file to output", 0);
+    plap_positional_string(&adef, "output-header-file-path", "header file (or .gramcol column cache) to output", 0);
     plap_option_int(&adef, "p", "print", "print csv file contents summary", 0);
+    plap_option_int(&adef, "c", "cache", "write a binary column cache (.gramcol) next to the csv file", 0);
+    plap_option_string(&adef, "f", "format", "header values as `text` (default), exact `hex` floats or a `blob` file", 1);
+    plap_option_string(&adef, "e", "emit-plugin", "write the source of a gram plugin (.c) serving the csv data, with its header and CMake target", 1);
     Args a = plap_parse_args(adef, argc, args);
 
     char* in_path = plap_get_positional(&a, 0)->str;
     PositionalArg* out_path_a = plap_get_positional(&a, 1);
 
-    CSVFile csv = {0};
-    if(gram_csv_load_csv(in_path, &csv)){
-        fprintf(stderr, "%s\n", gram_csv_err_msg());
-        exit(-1);
-    }
+    GramCsvParser parser;
+    gram_csv_parser_init(&parser);
 
-    if (!out_path_a || plap_get_option(&a, "p", "print")) {
-        print_csv(&csv);
+    Option* cache = plap_get_option(&a, "c", "cache");
+    Option* plugin = plap_get_option(&a, "e", "emit-plugin");
+    if ((!out_path_a && !cache && !plugin) || plap_get_option(&a, "p", "print")) {
+        if (print_csv(&parser, in_path)) {
+            fprintf(stderr, "%s\n", gram_csv_parser_err_msg(&parser));
+            exit(-1);
+        }
     }
-    if (out_path_a) {
+    int cache_out = out_path_a && is_cache_path(out_path_a->str);
+    if (out_path_a && !cache_out) {
+        GramCsvHeaderMode mode = header_mode(plap_get_option(&a, "f", "format"));
+        CSVFile csv = { 0 };
+        load(&parser, in_path, &csv);
         const char* out_file = out_path_a->str;
-        gram_csv_write_header_file(&csv, out_file);
+        if (gram_csv_write_header(&csv, out_file, mode)) {
+            fprintf(stderr, "Could not write header file `%s`\n", out_file);
+            exit(-1);
+        }
         printf("File written to `%s`\n", out_path_a->str);
+        if (mode == GRAMCSV_HEADER_BLOB) {
+            char* blob_path = gram_csv_blob_path(out_file);
+            printf("Values written to `%s`\n", blob_path);
+            free(blob_path);
+        }
+        gram_csv_csv_file_free(csv);
+    }
+    if (plugin) {
+        // plugins get exact values unless asked otherwise
+        Option* format = plap_get_option(&a, "f", "format");
+        GramCsvHeaderMode mode = format ? header_mode(format) : GRAMCSV_HEADER_HEX;
+        CSVFile csv = { 0 };
+        load(&parser, in_path, &csv);
+        if (gram_csv_write_plugin(&csv, plugin->str, mode)) {
+            fprintf(stderr, "Could not write plugin `%s`\n", plugin->str);
+            exit(-1);
+        }
+        char* header_path = gram_csv_plugin_path(plugin->str, "_data.h");
+        char* cmake_path = gram_csv_plugin_path(plugin->str, ".cmake");
+        printf("Plugin written to `%s` (data in `%s`, target in `%s`)\n", plugin->str, header_path, cmake_path);
+        free(header_path);
+        free(cmake_path);
+        gram_csv_csv_file_free(csv);
+    }
+    if (cache_out || cache) {
+        // caches keep every column in its narrowest exact type, text columns included
+        CSVFile csv = { 0 };
+        parser.infer_types = 1;
+        load(&parser, in_path, &csv);
+        if (cache_out) {
+            write_cache(&csv, out_path_a->str);
+        }
+        if (cache) {
+            char* cache_path = gram_csv_cache_path(in_path);
+            write_cache(&csv, cache_path);
+            free(cache_path);
+        }
+        gram_csv_csv_file_free(csv);
     }
-    gram_csv_csv_file_free(csv);
     plap_free_args(a);
     return 0;
 }
@@ -0,0 +1,88 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gram_csv_arena.h"
+
+#define ARENA_ALIGN 64
+
+struct csv_arena_block {
+    csv_arena_block_t* next;
+    size_t size;
+    size_t used;
+};
+
+/// the first usable byte of a block, right after the block header
+#define BLOCK_DATA(B) ((char*)(B) + ARENA_ALIGN)
+
+static csv_arena_block_t* block_new(size_t size)
+{
+    csv_arena_block_t* b = aligned_alloc(ARENA_ALIGN, (ARENA_ALIGN + size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN);
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+void csv_arena_init(csv_arena_t* arena, size_t block_sz)
+{
+    *arena = (csv_arena_t) { .head = NULL, .block_sz = block_sz };
+}
+
+void* csv_arena_alloc(csv_arena_t* arena, size_t size, size_t align)
+{
+    csv_arena_block_t* b = arena->head;
+    if (b) {
+        size_t at = (b->used + align - 1) & ~(align - 1);
+        if (at + size <= b->size) {
+            b->used = at + size;
+            return BLOCK_DATA(b) + at;
+        }
+    }
+    // allocations larger than a block get a block of their own
+    b = block_new(size > arena->block_sz ? size : arena->block_sz);
+    b->next = arena->head;
+    arena->head = b;
+    b->used = size;
+    return BLOCK_DATA(b);
+}
+
+char* csv_arena_strdup(csv_arena_t* arena, const char* str)
+{
+    size_t len = strlen(str) + 1;
+    char* s = csv_arena_alloc(arena, len, 1);
+    memcpy(s, str, len);
+    return s;
+}
+
+void csv_arena_reset(csv_arena_t* arena)
+{
+    if (!arena->head)
+        return;
+    csv_arena_block_t* b = arena->head->next;
+    while (b) {
+        csv_arena_block_t* next = b->next;
+        free(b);
+        b = next;
+    }
+    arena->head->next = NULL;
+    arena->head->used = 0;
+}
+
+void csv_arena_free(csv_arena_t* arena)
+{
+    csv_arena_reset(arena);
+    free(arena->head);
+    arena->head = NULL;
+}
+
+void* csv_arena_release(csv_arena_t* arena)
+{
+    void* mem = arena->head;
+    arena->head = NULL;
+    return mem;
+}
+
+size_t csv_arena_need(size_t size, size_t align)
+{
+    return size + align - 1;
+}
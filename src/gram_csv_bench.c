@@ -0,0 +1,371 @@
+#include "gram_csv.h"
+#include "loadfns.h"
+#include <lauxlib.h>
+#include <lua.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#define PLAP_IMPLEMENTATION
+#include "plap.h"
+
+// Generates synthetic csv files and times loading them. Every case runs in a child
+// process so its peak RSS is its own. The results are written to stdout as csv,
+// one line per case and phase:
+//   case,rows,columns,quoted,crlf,format,bytes,phase,seconds,mb_s,rows_s,allocs,alloc_bytes,peak_rss_kb
+// `seconds` is the best of the repeats, allocations are counted for the last one
+
+#define DEFAULT_ROWS 1000000
+#define DEFAULT_REPEAT 3
+#define DEFAULT_SEED 1
+#define GEN_BUF_SZ (1 << 16)
+
+typedef enum {
+    FMT_INT = 0,
+    FMT_FIXED,
+    FMT_EXP,
+    FMT_MIXED,
+} bench_format_t;
+
+static const char* FORMAT_NAMES[] = { "int", "fixed", "exp", "mixed" };
+
+typedef struct {
+    const char* name;
+    /// rows of the case relative to the rows asked for on the command line, in percent
+    size_t rows_percent;
+    size_t columns;
+    /// fields put in quotes, in percent
+    unsigned quoted;
+    int crlf;
+    bench_format_t format;
+} bench_case_t;
+
+/// the suite, changing it makes results incomparable with earlier releases
+static const bench_case_t CASES[] = {
+    { "fixed", 100, 4, 0, 0, FMT_FIXED },
+    { "int", 100, 4, 0, 0, FMT_INT },
+    { "exp", 100, 4, 0, 0, FMT_EXP },
+    { "mixed", 100, 4, 0, 0, FMT_MIXED },
+    { "quoted_some", 100, 4, 10, 0, FMT_FIXED },
+    { "quoted_all", 100, 4, 100, 0, FMT_FIXED },
+    { "crlf", 100, 4, 0, 1, FMT_FIXED },
+    { "wide", 10, 64, 0, 0, FMT_MIXED },
+    { "narrow", 400, 1, 0, 0, FMT_FIXED },
+};
+
+typedef enum {
+    PHASE_LOAD = 0,
+    PHASE_TABLE,
+} bench_phase_t;
+
+static const char* PHASE_NAMES[] = { "load", "table" };
+
+typedef struct {
+    double seconds;
+    size_t rows;
+    size_t allocs;
+    size_t alloc_bytes;
+    int failed;
+} bench_result_t;
+
+// every allocation of the process goes through these, counted while `s_counting` is set
+#ifdef __GLIBC__
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t align, size_t size);
+extern void __libc_free(void* ptr);
+
+static int s_counting = 0;
+static size_t s_allocs = 0;
+static size_t s_alloc_bytes = 0;
+
+static void count_alloc(size_t size)
+{
+    if (__atomic_load_n(&s_counting, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&s_allocs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&s_alloc_bytes, size, __ATOMIC_RELAXED);
+    }
+}
+
+void* malloc(size_t size)
+{
+    count_alloc(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    count_alloc(n * size);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    if (size)
+        count_alloc(size);
+    return __libc_realloc(ptr, size);
+}
+
+void* aligned_alloc(size_t align, size_t size)
+{
+    count_alloc(size);
+    return __libc_memalign(align, size);
+}
+
+void free(void* ptr)
+{
+    __libc_free(ptr);
+}
+
+static void count_start(void)
+{
+    s_allocs = 0;
+    s_alloc_bytes = 0;
+    __atomic_store_n(&s_counting, 1, __ATOMIC_RELAXED);
+}
+
+static void count_stop(bench_result_t* r)
+{
+    __atomic_store_n(&s_counting, 0, __ATOMIC_RELAXED);
+    r->allocs = s_allocs;
+    r->alloc_bytes = s_alloc_bytes;
+}
+#else
+// allocations are not counted (reported as 0) without glibc to forward them to
+static void count_start(void) { }
+static void count_stop(bench_result_t* r)
+{
+    (void)r;
+}
+#endif
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// splitmix64, the same seed always gives the same files
+static uint64_t next_random(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/// writes one field of `format` to `dst`, returns its length
+static int format_field(uint64_t* state, bench_format_t format, char* dst, size_t sz)
+{
+    uint64_t r = next_random(state);
+    if (format == FMT_MIXED)
+        format = r % 3;
+    // 53 random bits as a double in [0, 1)
+    double unit = (next_random(state) >> 11) * 0x1p-53;
+    double sign = r & 0x100 ? -1 : 1;
+    switch (format) {
+    case FMT_INT:
+        return snprintf(dst, sz, "%lld", (long long)(sign * (r >> 40)));
+    case FMT_FIXED:
+        return snprintf(dst, sz, "%.6f", sign * unit * 100000);
+    default:
+        return snprintf(dst, sz, "%.17e", sign * unit * 1e-3 * (double)((r >> 20) & 0xffff));
+    }
+}
+
+/// writes the csv file of `c`, returns its size in bytes (0 if it could not be written)
+static size_t generate(const bench_case_t* c, size_t rows, uint64_t seed, const char* path)
+{
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return 0;
+    const char* eol = c->crlf ? "\r\n" : "\n";
+    // every case gets its own sequence
+    uint64_t state = seed ^ ((uint64_t)(c - CASES) << 32);
+    char* buf = malloc(GEN_BUF_SZ);
+    size_t len = 0;
+    size_t total = 0;
+    for (size_t col = 0; col < c->columns; col++) {
+        len += snprintf(buf + len, GEN_BUF_SZ - len, "%sc%zu", col ? "," : "", col);
+    }
+    len += snprintf(buf + len, GEN_BUF_SZ - len, "%s", eol);
+    for (size_t row = 0; row < rows; row++) {
+        for (size_t col = 0; col < c->columns; col++) {
+            // room for the longest field with its quotes and separator
+            if (GEN_BUF_SZ - len < 64) {
+                fwrite(buf, 1, len, f);
+                total += len;
+                len = 0;
+            }
+            if (col)
+                buf[len++] = ',';
+            int quoted = next_random(&state) % 100 < c->quoted;
+            if (quoted)
+                buf[len++] = '"';
+            len += format_field(&state, c->format, buf + len, GEN_BUF_SZ - len);
+            if (quoted)
+                buf[len++] = '"';
+        }
+        memcpy(buf + len, eol, strlen(eol));
+        len += strlen(eol);
+    }
+    fwrite(buf, 1, len, f);
+    total += len;
+    free(buf);
+    int failed = ferror(f);
+    failed |= fclose(f) != 0;
+    return failed ? 0 : total;
+}
+
+/// loads `path` (and hands it to lua as `Gram.load_csv` does for `PHASE_TABLE`), timing only the phase
+static bench_result_t run_phase(const char* path, bench_phase_t phase)
+{
+    bench_result_t r = { 0 };
+    GramCsvParser parser;
+    gram_csv_parser_init(&parser);
+    CSVFile csv = { 0 };
+    if (phase == PHASE_LOAD)
+        count_start();
+    double start = now();
+    if (gram_csv_parser_load(&parser, path, &csv)) {
+        fprintf(stderr, "%s\n", gram_csv_parser_err_msg(&parser));
+        count_stop(&r);
+        r.failed = 1;
+        return r;
+    }
+    r.seconds = now() - start;
+    r.rows = csv.col_len;
+    if (phase == PHASE_LOAD) {
+        count_stop(&r);
+        gram_csv_csv_file_free(csv);
+        return r;
+    }
+    lua_State* l = luaL_newstate();
+    count_start();
+    start = now();
+    make_csv_table(l, &csv);
+    r.seconds = now() - start;
+    count_stop(&r);
+    lua_close(l);
+    return r;
+}
+
+/// runs the phase `repeat` times in a child process and keeps the fastest run,
+/// `peak_rss_kb` is that of the child
+static bench_result_t measure(const char* path, bench_phase_t phase, size_t repeat, long* peak_rss_kb)
+{
+    bench_result_t best = { .failed = 1 };
+    int fds[2];
+    if (pipe(fds))
+        return best;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return best;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        for (size_t i = 0; i < repeat; i++) {
+            bench_result_t r = run_phase(path, phase);
+            // the fastest time, the allocations of the last run
+            double fastest = i == 0 || r.seconds < best.seconds ? r.seconds : best.seconds;
+            best = r;
+            best.seconds = fastest;
+            if (r.failed)
+                break;
+        }
+        ssize_t written = write(fds[1], &best, sizeof best);
+        close(fds[1]);
+        _exit(written == sizeof best ? 0 : 1);
+    }
+    close(fds[1]);
+    bench_result_t r;
+    ssize_t got = read(fds[0], &r, sizeof r);
+    close(fds[0]);
+    int status = 0;
+    struct rusage usage = { 0 };
+    wait4(pid, &status, 0, &usage);
+    if (got == sizeof r && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        best = r;
+    *peak_rss_kb = usage.ru_maxrss;
+    return best;
+}
+
+static size_t option_size(Args* a, const char* s, const char* l, size_t def)
+{
+    Option* o = plap_get_option(a, s, l);
+    if (!o)
+        return def;
+    char* end;
+    unsigned long long v = strtoull(o->str, &end, 10);
+    if (*end || end == o->str) {
+        fprintf(stderr, "`%s` has to be a non negative integer\n", l);
+        exit(-1);
+    }
+    return v;
+}
+
+int main(int argc, char** args)
+{
+    ArgsDef adef = plap_args_def();
+    plap_program_desc(&adef, "gram_csv_bench", "times loading synthetic csv files, results go to stdout as csv");
+    plap_option_string(&adef, "r", "rows", "rows of the base cases (default 1000000)", 1);
+    plap_option_string(&adef, "n", "repeat", "runs per case and phase, the fastest is reported (default 3)", 1);
+    plap_option_string(&adef, "s", "seed", "seed of the generated data (default 1)", 1);
+    plap_option_string(&adef, "d", "dir", "directory the files are generated in (default /tmp)", 1);
+    plap_option_string(&adef, "c", "case", "only run the case with this name", 1);
+    plap_option_int(&adef, "k", "keep", "keep the generated files", 0);
+    Args a = plap_parse_args(adef, argc, args);
+
+    size_t rows = option_size(&a, "r", "rows", DEFAULT_ROWS);
+    size_t repeat = option_size(&a, "n", "repeat", DEFAULT_REPEAT);
+    uint64_t seed = option_size(&a, "s", "seed", DEFAULT_SEED);
+    Option* dir = plap_get_option(&a, "d", "dir");
+    Option* only = plap_get_option(&a, "c", "case");
+    int keep = plap_get_option(&a, "k", "keep") != NULL;
+    repeat = repeat ? repeat : 1;
+
+    printf("case,rows,columns,quoted,crlf,format,bytes,phase,seconds,mb_s,rows_s,allocs,alloc_bytes,peak_rss_kb\n");
+    fflush(stdout);
+    int failed = 0;
+    for (size_t i = 0; i < sizeof CASES / sizeof CASES[0]; i++) {
+        const bench_case_t* c = &CASES[i];
+        if (only && strcmp(only->str, c->name) != 0)
+            continue;
+        size_t case_rows = rows * c->rows_percent / 100;
+        char path[4096];
+        snprintf(path, sizeof path, "%s/gram_csv_bench_%s_%llu.csv", dir ? dir->str : "/tmp", c->name,
+            (unsigned long long)seed);
+        fprintf(stderr, "generating `%s`\n", path);
+        size_t bytes = generate(c, case_rows, seed, path);
+        if (!bytes) {
+            fprintf(stderr, "Could not write `%s`\n", path);
+            failed = 1;
+            continue;
+        }
+        for (bench_phase_t p = PHASE_LOAD; p <= PHASE_TABLE; p++) {
+            long peak_rss_kb = 0;
+            bench_result_t r = measure(path, p, repeat, &peak_rss_kb);
+            if (r.failed) {
+                fprintf(stderr, "case `%s` failed in phase `%s`\n", c->name, PHASE_NAMES[p]);
+                failed = 1;
+                continue;
+            }
+            printf("%s,%zu,%zu,%u,%d,%s,%zu,%s,%.6f,%.2f,%.0f,%zu,%zu,%ld\n", c->name, r.rows, c->columns, c->quoted,
+                c->crlf, FORMAT_NAMES[c->format], bytes, PHASE_NAMES[p], r.seconds, bytes / 1e6 / r.seconds,
+                r.rows / r.seconds, r.allocs, r.alloc_bytes, peak_rss_kb);
+            fflush(stdout);
+        }
+        if (!keep)
+            remove(path);
+    }
+    plap_free_args(a);
+    return failed;
+}
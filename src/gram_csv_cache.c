@@ -0,0 +1,381 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gram_csv.h"
+#include "gram_csv_arena.h"
+#include "gram_csv_column.h"
+
+// Layout of a `.gramcol` file, every number is little endian:
+//
+//   header      magic[8] version:u32 flags:u32 column_count:u64 row_count:u64
+//               names_offset:u64 names_size:u64
+//   directory   per column: offset:u64 type:u32 dict_len:u32 min:f64 max:f64
+//   names       NUL terminated file name, the NUL terminated headers and then
+//               the `dict_len` NUL terminated dictionary entries of every column
+//   columns     `row_count` values of the column type (GramCsvType) per column,
+//               each block GRAMCOL_ALIGN aligned
+
+#define GRAMCOL_MAGIC "GRAMCOL"
+#define GRAMCOL_VERSION 2
+#define GRAMCOL_ALIGN 64
+#define GRAMCOL_HEADER_SZ 48
+#define GRAMCOL_ENTRY_SZ 32
+#define GRAMCOL_EXT ".gramcol"
+
+#define GRAMCOL_FLAG_MINMAX (1 << 0)
+
+#define SET_ERR(BUF, FMT, ...) \
+    snprintf(BUF, GRAMCSV_ERR_MSG_SZ, FMT, ##__VA_ARGS__)
+
+static int host_is_little_endian(void)
+{
+    const uint16_t one = 1;
+    return *(const unsigned char*)&one == 1;
+}
+
+static void put_u32(unsigned char* p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = v >> (i * 8);
+}
+static void put_u64(unsigned char* p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = v >> (i * 8);
+}
+static uint32_t get_u32(const unsigned char* p)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++)
+        v |= (uint32_t)p[i] << (i * 8);
+    return v;
+}
+static uint64_t get_u64(const unsigned char* p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++)
+        v |= (uint64_t)p[i] << (i * 8);
+    return v;
+}
+/// writes `n` values of `size` bytes as little endian
+static void write_le(FILE* f, const void* data, size_t size, size_t n)
+{
+    if (host_is_little_endian()) {
+        fwrite(data, size, n, f);
+        return;
+    }
+    const unsigned char* src = data;
+    unsigned char buf[8 * 512];
+    for (size_t i = 0; i < n; i += 512) {
+        size_t k = n - i < 512 ? n - i : 512;
+        for (size_t v = 0; v < k; v++)
+            for (size_t b = 0; b < size; b++)
+                buf[v * size + b] = src[(i + v) * size + size - 1 - b];
+        fwrite(buf, size, k, f);
+    }
+}
+static void put_f64(unsigned char* p, double d)
+{
+    uint64_t v;
+    memcpy(&v, &d, sizeof v);
+    put_u64(p, v);
+}
+static size_t align_up(size_t v)
+{
+    return (v + GRAMCOL_ALIGN - 1) / GRAMCOL_ALIGN * GRAMCOL_ALIGN;
+}
+
+/// drops the columns not named in `parser->select`, the mapping stays as it is
+/// and pages of dropped columns are simply never touched (neither are their names
+/// in the allocation of the file). Returns 0 if no error
+static int select_columns(GramCsvParser* parser, CSVFile* csv)
+{
+    unsigned char* keep = calloc(csv->col_count, sizeof(unsigned char));
+    for (size_t s = 0; s < parser->select_count; s++) {
+        size_t c = 0;
+        while (c < csv->col_count && strcmp(csv->headers[c], parser->select[s]) != 0)
+            c++;
+        if (c == csv->col_count) {
+            SET_ERR(parser->err, "No column named `%s`", parser->select[s]);
+            free(keep);
+            return GRAMCSV_ERR_NO_SUCH_COLUMN;
+        }
+        keep[c] = 1;
+    }
+    size_t n = 0;
+    for (size_t c = 0; c < csv->col_count; c++) {
+        if (!keep[c])
+            continue;
+        csv->headers[n] = csv->headers[c];
+        csv->columns[n] = csv->columns[c];
+        if (csv->typed)
+            csv->typed[n] = csv->typed[c];
+        n++;
+    }
+    csv->header_count = n;
+    csv->col_count = n;
+    free(keep);
+    return 0;
+}
+
+char* gram_csv_cache_path(const char* csv_file)
+{
+    size_t len = strlen(csv_file);
+    const char* sep = strrchr(csv_file, '/');
+    // `data.csv.gz` and `data.csv.zst` share the cache of `data.csv`
+    static const char* exts[] = { ".csv", ".csv.gz", ".csv.zst" };
+    for (size_t i = 0; i < sizeof exts / sizeof *exts; i++) {
+        size_t ext_len = strlen(exts[i]);
+        if (len <= ext_len)
+            continue;
+        const char* ext = csv_file + len - ext_len;
+        if ((!sep || ext > sep) && strcmp(ext, exts[i]) == 0) {
+            len -= ext_len;
+            break;
+        }
+    }
+    char* path = calloc(len + sizeof GRAMCOL_EXT, sizeof(char));
+    memcpy(path, csv_file, len);
+    strcpy(path + len, GRAMCOL_EXT);
+    return path;
+}
+
+int gram_csv_write_cache(CSVFile* csv, const char* cache_file)
+{
+    size_t names_size = strlen(csv->file_name) + 1;
+    for (size_t c = 0; c < csv->col_count; c++) {
+        names_size += strlen(csv->headers[c]) + 1;
+        for (size_t d = 0; csv->typed && d < csv->typed[c].dict_len; d++) {
+            names_size += strlen(csv->typed[c].dict[d]) + 1;
+        }
+    }
+    size_t names_offset = GRAMCOL_HEADER_SZ + csv->col_count * GRAMCOL_ENTRY_SZ;
+    size_t data_offset = align_up(names_offset + names_size);
+
+    // written next to the target and renamed over it so readers never see half a file
+    char* tmp = calloc(strlen(cache_file) + 5, sizeof(char));
+    sprintf(tmp, "%s.tmp", cache_file);
+    FILE* f = fopen(tmp, "wb");
+    if (!f) {
+        free(tmp);
+        return GRAMCSV_ERR_COULD_NOT_OPEN_FILE;
+    }
+    unsigned char head[GRAMCOL_HEADER_SZ] = { 0 };
+    memcpy(head, GRAMCOL_MAGIC, sizeof GRAMCOL_MAGIC);
+    put_u32(head + 8, GRAMCOL_VERSION);
+    put_u32(head + 12, GRAMCOL_FLAG_MINMAX);
+    put_u64(head + 16, csv->col_count);
+    put_u64(head + 24, csv->col_len);
+    put_u64(head + 32, names_offset);
+    put_u64(head + 40, names_size);
+    fwrite(head, 1, sizeof head, f);
+
+    size_t offset = data_offset;
+    for (size_t c = 0; c < csv->col_count; c++) {
+        double min = 0, max = 0;
+        gram_csv_column_range(csv, c, &min, &max);
+        GramCsvType type = gram_csv_column_type(csv, c);
+        unsigned char entry[GRAMCOL_ENTRY_SZ] = { 0 };
+        put_u64(entry, offset);
+        put_u32(entry + 8, type);
+        put_u32(entry + 12, csv->typed ? csv->typed[c].dict_len : 0);
+        put_f64(entry + 16, min);
+        put_f64(entry + 24, max);
+        fwrite(entry, 1, sizeof entry, f);
+        offset += align_up(csv->col_len * csv_type_size(type));
+    }
+
+    fwrite(csv->file_name, 1, strlen(csv->file_name) + 1, f);
+    for (size_t c = 0; c < csv->col_count; c++) {
+        fwrite(csv->headers[c], 1, strlen(csv->headers[c]) + 1, f);
+    }
+    for (size_t c = 0; csv->typed && c < csv->col_count; c++) {
+        for (size_t d = 0; d < csv->typed[c].dict_len; d++) {
+            fwrite(csv->typed[c].dict[d], 1, strlen(csv->typed[c].dict[d]) + 1, f);
+        }
+    }
+    static const unsigned char pad[GRAMCOL_ALIGN] = { 0 };
+    fwrite(pad, 1, data_offset - names_offset - names_size, f);
+
+    for (size_t c = 0; c < csv->col_count; c++) {
+        size_t size = csv_type_size(gram_csv_column_type(csv, c));
+        write_le(f, csv->typed ? csv->typed[c].data : csv->columns[c], size, csv->col_len);
+        fwrite(pad, 1, align_up(csv->col_len * size) - csv->col_len * size, f);
+    }
+    int failed = ferror(f);
+    failed |= fclose(f) != 0;
+    if (failed || rename(tmp, cache_file)) {
+        remove(tmp);
+        free(tmp);
+        return GRAMCSV_ERR_COULD_NOT_OPEN_FILE;
+    }
+    free(tmp);
+    return 0;
+}
+
+int gram_csv_parser_load_cache(GramCsvParser* parser, const char* cache_file, CSVFile* ret)
+{
+    *ret = (CSVFile) { 0 };
+    parser->err[0] = '\0';
+    if (!host_is_little_endian()) {
+        SET_ERR(parser->err, "Column cache can only be mapped on little endian hosts");
+        return GRAMCSV_ERR_BAD_CACHE;
+    }
+    int fd = open(cache_file, O_RDONLY);
+    if (fd < 0) {
+        SET_ERR(parser->err, "Could not open file for reading");
+        return GRAMCSV_ERR_COULD_NOT_OPEN_FILE;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < GRAMCOL_HEADER_SZ) {
+        close(fd);
+        SET_ERR(parser->err, "Column cache `%s` is truncated", cache_file);
+        return GRAMCSV_ERR_BAD_CACHE;
+    }
+    size_t map_len = st.st_size;
+    // private and writable so the columns behave like heap memory, writes never reach the file
+    unsigned char* map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        SET_ERR(parser->err, "Could not open file for reading");
+        return GRAMCSV_ERR_COULD_NOT_OPEN_FILE;
+    }
+    if (memcmp(map, GRAMCOL_MAGIC, sizeof GRAMCOL_MAGIC) != 0 || get_u32(map + 8) != GRAMCOL_VERSION) {
+        munmap(map, map_len);
+        SET_ERR(parser->err, "`%s` is not a column cache of this version", cache_file);
+        return GRAMCSV_ERR_BAD_CACHE;
+    }
+    uint64_t col_count = get_u64(map + 16);
+    uint64_t row_count = get_u64(map + 24);
+    uint64_t names_offset = get_u64(map + 32);
+    uint64_t names_size = get_u64(map + 40);
+    int bad = col_count == 0 || col_count > map_len / GRAMCOL_ENTRY_SZ
+        || names_offset != GRAMCOL_HEADER_SZ + col_count * GRAMCOL_ENTRY_SZ
+        || names_size > map_len || names_offset + names_size > map_len
+        || names_size == 0 || map[names_offset + names_size - 1] != '\0';
+    int typed = 0;
+    for (uint64_t c = 0; !bad && c < col_count; c++) {
+        const unsigned char* entry = map + GRAMCOL_HEADER_SZ + c * GRAMCOL_ENTRY_SZ;
+        uint64_t offset = get_u64(entry);
+        uint32_t type = get_u32(entry + 8);
+        // every dictionary entry takes at least its NUL out of the names
+        bad = type > GRAMCSV_TYPE_DICT || (type != GRAMCSV_TYPE_DICT && get_u32(entry + 12))
+            || get_u32(entry + 12) > names_size
+            || offset % GRAMCOL_ALIGN != 0 || offset > map_len
+            || row_count > (map_len - offset) / csv_type_size(type);
+        typed |= type != GRAMCSV_TYPE_DOUBLE;
+    }
+    if (bad) {
+        munmap(map, map_len);
+        SET_ERR(parser->err, "Column cache `%s` is corrupted", cache_file);
+        return GRAMCSV_ERR_BAD_CACHE;
+    }
+
+    const char* names = (const char*)map + names_offset;
+    const char* names_end = names + names_size;
+    // names and dictionaries stay in the mapping, one allocation holds the pointers to them
+    size_t sz = csv_arena_need(col_count * sizeof(char*), sizeof(char*))
+        + csv_arena_need(col_count * sizeof(double*), sizeof(double*))
+        + csv_arena_need(col_count * sizeof(GramCsvColumn), sizeof(void*));
+    for (uint64_t c = 0; c < col_count; c++) {
+        uint32_t dict_len = get_u32(map + GRAMCOL_HEADER_SZ + c * GRAMCOL_ENTRY_SZ + 12);
+        sz += csv_arena_need(dict_len * sizeof(char*), sizeof(char*));
+    }
+    csv_arena_t arena;
+    csv_arena_init(&arena, sz);
+    ret->file_name = (char*)names;
+    names += strlen(names) + 1;
+    ret->header_count = col_count;
+    ret->col_count = col_count;
+    ret->col_len = row_count;
+    ret->headers = csv_arena_alloc(&arena, col_count * sizeof(char*), sizeof(char*));
+    ret->columns = csv_arena_alloc(&arena, col_count * sizeof(double*), sizeof(double*));
+    ret->typed = typed ? csv_arena_alloc(&arena, col_count * sizeof(GramCsvColumn), sizeof(void*)) : NULL;
+    ret->map = map;
+    ret->map_len = map_len;
+    for (uint64_t c = 0; c < col_count; c++) {
+        ret->headers[c] = (char*)(names < names_end ? names : "");
+        names += names < names_end ? strlen(names) + 1 : 0;
+    }
+    for (uint64_t c = 0; c < col_count; c++) {
+        const unsigned char* entry = map + GRAMCOL_HEADER_SZ + c * GRAMCOL_ENTRY_SZ;
+        void* data = map + get_u64(entry);
+        if (!typed) {
+            ret->columns[c] = data;
+            continue;
+        }
+        GramCsvColumn* col = &ret->typed[c];
+        *col = (GramCsvColumn) { .type = get_u32(entry + 8), .data = data, .dict_len = get_u32(entry + 12) };
+        ret->columns[c] = col->type == GRAMCSV_TYPE_DOUBLE ? data : NULL;
+        if (col->type != GRAMCSV_TYPE_DICT)
+            continue;
+        // the entries are not copied out of the mapping, every code has to be checked once
+        col->dict = csv_arena_alloc(&arena, col->dict_len * sizeof(char*), sizeof(char*));
+        for (size_t d = 0; d < col->dict_len; d++) {
+            bad |= names >= names_end;
+            col->dict[d] = (char*)(names < names_end ? names : "");
+            names += names < names_end ? strlen(names) + 1 : 0;
+        }
+        for (size_t i = 0; !bad && i < row_count; i++) {
+            bad = ((const uint32_t*)data)[i] >= col->dict_len;
+        }
+    }
+    ret->mem = csv_arena_release(&arena);
+    if (bad) {
+        gram_csv_csv_file_free(*ret);
+        *ret = (CSVFile) { 0 };
+        SET_ERR(parser->err, "Column cache `%s` is corrupted", cache_file);
+        return GRAMCSV_ERR_BAD_CACHE;
+    }
+    if (parser->select && parser->select_count && select_columns(parser, ret)) {
+        gram_csv_csv_file_free(*ret);
+        *ret = (CSVFile) { 0 };
+        return GRAMCSV_ERR_NO_SUCH_COLUMN;
+    }
+    return 0;
+}
+
+/// checks that a loaded cache holds every column in a type the settings of `parser` allow:
+/// hinted columns as hinted and, without type inference, the rest as doubles
+static int cache_types_match(const GramCsvParser* parser, const CSVFile* csv)
+{
+    for (size_t c = 0; c < csv->col_count; c++) {
+        GramCsvType type = csv->typed ? csv->typed[c].type : GRAMCSV_TYPE_DOUBLE;
+        int hinted = 0;
+        for (size_t h = 0; h < parser->hint_count; h++) {
+            if (strcmp(parser->hints[h].name, csv->headers[c]) == 0) {
+                if (type != parser->hints[h].type)
+                    return 0;
+                hinted = 1;
+            }
+        }
+        if (!hinted && !parser->infer_types && type != GRAMCSV_TYPE_DOUBLE)
+            return 0;
+    }
+    return 1;
+}
+
+int gram_csv_parser_load_cached(GramCsvParser* parser, const char* csv_file, CSVFile* ret)
+{
+    char* cache_file = gram_csv_cache_path(csv_file);
+    struct stat csv_st, cache_st;
+    int fresh = stat(cache_file, &cache_st) == 0
+        && (stat(csv_file, &csv_st) != 0
+            || cache_st.st_mtim.tv_sec > csv_st.st_mtim.tv_sec
+            || (cache_st.st_mtim.tv_sec == csv_st.st_mtim.tv_sec && cache_st.st_mtim.tv_nsec > csv_st.st_mtim.tv_nsec));
+    if (fresh && gram_csv_parser_load_cache(parser, cache_file, ret) == 0) {
+        free(cache_file);
+        if (cache_types_match(parser, ret))
+            return 0;
+        // written with other types than asked for, the file is parsed instead
+        gram_csv_csv_file_free(*ret);
+        return gram_csv_parser_load(parser, csv_file, ret);
+    }
+    free(cache_file);
+    return gram_csv_parser_load(parser, csv_file, ret);
+}
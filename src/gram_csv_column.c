@@ -0,0 +1,345 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "gram_csv.h"
+#include "gram_csv_column.h"
+
+#define COLUMN_MIN_CAP 4096
+/// integers above this magnitude are not exact as float32
+#define FLOAT_INT_MAX (1u << 24)
+
+size_t csv_type_size(GramCsvType type)
+{
+    switch (type) {
+    case GRAMCSV_TYPE_FLOAT:
+        return sizeof(float);
+    case GRAMCSV_TYPE_INT32:
+        return sizeof(int32_t);
+    case GRAMCSV_TYPE_DICT:
+        return sizeof(uint32_t);
+    default:
+        return sizeof(double);
+    }
+}
+
+static double get_value(GramCsvType type, const void* data, size_t i)
+{
+    switch (type) {
+    case GRAMCSV_TYPE_FLOAT:
+        return ((const float*)data)[i];
+    case GRAMCSV_TYPE_INT32:
+        return ((const int32_t*)data)[i];
+    case GRAMCSV_TYPE_DICT:
+        return ((const uint32_t*)data)[i];
+    default:
+        return ((const double*)data)[i];
+    }
+}
+
+static void set_value(GramCsvType type, void* data, size_t i, double v)
+{
+    switch (type) {
+    case GRAMCSV_TYPE_FLOAT:
+        ((float*)data)[i] = (float)v;
+        break;
+    case GRAMCSV_TYPE_INT32:
+        // hinted int32 columns truncate and saturate like a careful cast would
+        ((int32_t*)data)[i] = isnan(v) ? 0 : v >= INT32_MAX ? INT32_MAX : v <= INT32_MIN ? INT32_MIN : (int32_t)v;
+        break;
+    default:
+        ((double*)data)[i] = v;
+        break;
+    }
+}
+
+/// the narrowest numeric type that holds `v` exactly
+static GramCsvType exact_type(double v)
+{
+    if (v >= INT32_MIN && v <= INT32_MAX && v == (int32_t)v && !(v == 0 && signbit(v)))
+        return GRAMCSV_TYPE_INT32;
+    if ((double)(float)v == v || isnan(v))
+        return GRAMCSV_TYPE_FLOAT;
+    return GRAMCSV_TYPE_DOUBLE;
+}
+
+/// numeric types ordered from narrow to wide
+static int type_rank(GramCsvType type)
+{
+    return type == GRAMCSV_TYPE_INT32 ? 0 : type == GRAMCSV_TYPE_FLOAT ? 1 : 2;
+}
+
+/// the type both `a` and a column of type `b` with integers up to `int_max` fit in
+static GramCsvType wider_type(GramCsvType a, GramCsvType b, uint32_t int_max)
+{
+    GramCsvType w = type_rank(a) >= type_rank(b) ? a : b;
+    if (w == GRAMCSV_TYPE_FLOAT && int_max > FLOAT_INT_MAX)
+        return GRAMCSV_TYPE_DOUBLE;
+    return w;
+}
+
+/// converts the stored rows to a wider type, back to front so nothing is overwritten before it is read
+static void column_widen(csv_column_t* col, GramCsvType type)
+{
+    col->data = realloc(col->data, col->cap * csv_type_size(type));
+    for (size_t i = col->rows; i-- > 0;) {
+        set_value(type, col->data, i, get_value(col->type, col->data, i));
+    }
+    col->type = type;
+}
+
+static void column_grow(csv_column_t* col)
+{
+    if (col->rows < col->cap)
+        return;
+    col->cap = col->cap ? col->cap * 2 : COLUMN_MIN_CAP;
+    col->data = realloc(col->data, col->cap * csv_type_size(col->type));
+}
+
+void csv_column_init(csv_column_t* col, GramCsvType type, int fixed)
+{
+    *col = (csv_column_t) { .type = type, .fixed = fixed };
+    // inferred numeric columns start as narrow as possible
+    if (!fixed && type != GRAMCSV_TYPE_DICT)
+        col->type = GRAMCSV_TYPE_INT32;
+}
+
+void csv_column_free(csv_column_t* col)
+{
+    for (size_t i = 0; i < col->dict_len; i++) {
+        free(col->dict[i]);
+    }
+    free(col->dict);
+    free(col->dict_hash);
+    free(col->slots);
+    free(col->data);
+    *col = (csv_column_t) { 0 };
+}
+
+void csv_column_push_number(csv_column_t* col, double v)
+{
+    column_grow(col);
+    if (!col->fixed) {
+        GramCsvType need = exact_type(v);
+        if (need == GRAMCSV_TYPE_INT32) {
+            uint32_t mag = v < 0 ? (uint32_t)(-(int64_t)v) : (uint32_t)v;
+            if (col->type == GRAMCSV_TYPE_INT32)
+                col->int_max = mag > col->int_max ? mag : col->int_max;
+            else if (col->type == GRAMCSV_TYPE_FLOAT && mag > FLOAT_INT_MAX)
+                need = GRAMCSV_TYPE_DOUBLE;
+        }
+        if (type_rank(need) > type_rank(col->type))
+            column_widen(col, wider_type(need, col->type, col->int_max));
+    }
+    set_value(col->type, col->data, col->rows++, v);
+}
+
+static uint64_t hash_text(const char* str, size_t len)
+{
+    // FNV-1a
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)str[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static void dict_rehash(csv_column_t* col)
+{
+    col->slots_sz = col->slots_sz ? col->slots_sz * 2 : 64;
+    free(col->slots);
+    col->slots = calloc(col->slots_sz, sizeof(uint32_t));
+    size_t mask = col->slots_sz - 1;
+    for (size_t code = 0; code < col->dict_len; code++) {
+        size_t s = col->dict_hash[code] & mask;
+        while (col->slots[s])
+            s = (s + 1) & mask;
+        col->slots[s] = code + 1;
+    }
+}
+
+/// returns the code of the text, adding it to the dictionary if it is new
+static uint32_t dict_intern(csv_column_t* col, const char* str, size_t len, uint64_t hash)
+{
+    if ((col->dict_len + 1) * 2 > col->slots_sz)
+        dict_rehash(col);
+    size_t mask = col->slots_sz - 1;
+    size_t s = hash & mask;
+    while (col->slots[s]) {
+        uint32_t code = col->slots[s] - 1;
+        if (col->dict_hash[code] == hash && strncmp(col->dict[code], str, len) == 0 && col->dict[code][len] == '\0')
+            return code;
+        s = (s + 1) & mask;
+    }
+    if (col->dict_len == col->dict_cap) {
+        col->dict_cap = col->dict_cap ? col->dict_cap * 2 : 16;
+        col->dict = realloc(col->dict, col->dict_cap * sizeof(char*));
+        col->dict_hash = realloc(col->dict_hash, col->dict_cap * sizeof(uint64_t));
+    }
+    char* text = malloc(len + 1);
+    memcpy(text, str, len);
+    text[len] = '\0';
+    col->dict[col->dict_len] = text;
+    col->dict_hash[col->dict_len] = hash;
+    col->slots[s] = ++col->dict_len;
+    return col->dict_len - 1;
+}
+
+void csv_column_push_text(csv_column_t* col, const char* str, size_t len)
+{
+    // the dictionary holds C strings
+    len = strnlen(str, len);
+    column_grow(col);
+    ((uint32_t*)col->data)[col->rows++] = dict_intern(col, str, len, hash_text(str, len));
+}
+
+static void column_trim(csv_column_t* col)
+{
+    col->cap = col->rows ? col->rows : 1;
+    col->data = realloc(col->data, col->cap * csv_type_size(col->type));
+}
+
+void csv_column_merge(GramCsvColumn* out, csv_column_t* parts, size_t n)
+{
+    csv_column_t* col = &parts[0];
+    if (col->type == GRAMCSV_TYPE_DICT) {
+        for (size_t p = 1; p < n; p++) {
+            csv_column_t* part = &parts[p];
+            uint32_t* codes = malloc((part->dict_len ? part->dict_len : 1) * sizeof(uint32_t));
+            for (size_t c = 0; c < part->dict_len; c++) {
+                codes[c] = dict_intern(col, part->dict[c], strlen(part->dict[c]), part->dict_hash[c]);
+            }
+            for (size_t i = 0; i < part->rows; i++) {
+                column_grow(col);
+                ((uint32_t*)col->data)[col->rows++] = codes[((uint32_t*)part->data)[i]];
+            }
+            free(codes);
+            csv_column_free(part);
+        }
+    } else {
+        GramCsvType type = col->type;
+        uint32_t int_max = 0;
+        size_t rows = 0;
+        for (size_t p = 0; p < n; p++) {
+            type = type_rank(parts[p].type) > type_rank(type) ? parts[p].type : type;
+            int_max = parts[p].int_max > int_max ? parts[p].int_max : int_max;
+            rows += parts[p].rows;
+        }
+        type = wider_type(type, type, int_max);
+        if (type != col->type)
+            column_widen(col, type);
+        col->cap = rows > col->cap ? rows : col->cap;
+        col->data = realloc(col->data, (col->cap ? col->cap : 1) * csv_type_size(type));
+        for (size_t p = 1; p < n; p++) {
+            csv_column_t* part = &parts[p];
+            if (part->type == type) {
+                memcpy((char*)col->data + col->rows * csv_type_size(type), part->data, part->rows * csv_type_size(type));
+            } else {
+                for (size_t i = 0; i < part->rows; i++)
+                    set_value(type, col->data, col->rows + i, get_value(part->type, part->data, i));
+            }
+            col->rows += part->rows;
+            csv_column_free(part);
+        }
+    }
+    column_trim(col);
+    *out = (GramCsvColumn) {
+        .type = col->type,
+        .data = col->data,
+        .dict_len = col->dict_len,
+        .dict = col->dict,
+    };
+    if (out->dict_len) {
+        out->dict = realloc(out->dict, out->dict_len * sizeof(char*));
+    } else {
+        free(out->dict);
+        out->dict = NULL;
+    }
+    free(col->dict_hash);
+    free(col->slots);
+    *col = (csv_column_t) { 0 };
+}
+
+int csv_is_number(const char* str, size_t len)
+{
+    const char* p = str;
+    const char* end = str + len;
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+    if (p < end && (*p == '-' || *p == '+'))
+        p++;
+    size_t rest = end - p;
+    if ((rest == 3 && strncasecmp(p, "inf", 3) == 0) || (rest == 8 && strncasecmp(p, "infinity", 8) == 0)
+        || (rest == 3 && strncasecmp(p, "nan", 3) == 0))
+        return 1;
+    size_t digits = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        p++;
+        digits++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            p++;
+            digits++;
+        }
+    }
+    if (!digits)
+        return 0;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '-' || *p == '+'))
+            p++;
+        if (p == end)
+            return 0;
+        while (p < end && *p >= '0' && *p <= '9')
+            p++;
+    }
+    return p == end;
+}
+
+GramCsvType gram_csv_column_type(const CSVFile* csv, size_t col)
+{
+    return csv->typed ? csv->typed[col].type : GRAMCSV_TYPE_DOUBLE;
+}
+
+double gram_csv_value(const CSVFile* csv, size_t col, size_t row)
+{
+    if (!csv->typed)
+        return csv->columns[col][row];
+    return get_value(csv->typed[col].type, csv->typed[col].data, row);
+}
+
+const char* gram_csv_text(const CSVFile* csv, size_t col, size_t row)
+{
+    if (gram_csv_column_type(csv, col) != GRAMCSV_TYPE_DICT)
+        return NULL;
+    return csv->typed[col].dict[((const uint32_t*)csv->typed[col].data)[row]];
+}
+
+void gram_csv_read_column(const CSVFile* csv, size_t col, size_t row, size_t n, double* out)
+{
+    if (!csv->typed || csv->typed[col].type == GRAMCSV_TYPE_DOUBLE) {
+        memcpy(out, csv->columns[col] + row, n * sizeof(double));
+        return;
+    }
+    const GramCsvColumn* c = &csv->typed[col];
+    for (size_t i = 0; i < n; i++) {
+        out[i] = get_value(c->type, c->data, row + i);
+    }
+}
+
+void gram_csv_column_range(const CSVFile* csv, size_t col, double* min, double* max)
+{
+    *min = 0;
+    *max = 0;
+    for (size_t i = 0; i < csv->col_len; i++) {
+        double v = gram_csv_value(csv, col, i);
+        *min = (i == 0 || v < *min) ? v : *min;
+        *max = (i == 0 || v > *max) ? v : *max;
+    }
+}
@@ -0,0 +1,246 @@
+#include "gram_csv_float.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Checks that gram_csv_parse_double gives bit for bit what strtod gives, for hand picked
+// edge cases and random inputs. Prints the first mismatches and exits with 1 if there are any.
+//   gram_csv_float_test [random inputs (default 3000000)] [seed]
+
+#define DEFAULT_RANDOM 3000000
+#define DEFAULT_SEED 88172645463325252ull
+#define MAX_REPORTED 20
+
+static const char* HALFWAY[] = {
+    "9007199254740993",
+    "9007199254740993.0000000000000000001",
+    "9007199254740992.9999999999999999999",
+    "4503599627370496.5",
+    "4503599627370497.5",
+    "7.2057594037927933e16",
+    "1.7976931348623158e308",
+    "2.4703282292062327e-324",
+    "2.4703282292062328e-324",
+    "1.00000000000000011102230246251565404236316680908203125",
+    "1.00000000000000011102230246251565404236316680908203124",
+    "1.00000000000000011102230246251565404236316680908203126",
+    NULL,
+};
+
+static const char* SUBNORMAL[] = {
+    "4.9e-324",
+    "5e-324",
+    "1e-323",
+    "2.2250738585072009e-308",
+    "2.2250738585072011e-308",
+    "2.2250738585072014e-308",
+    "1e-310",
+    "-3.5e-320",
+    "1e-400",
+    "-1e-400",
+    "2.225073858507201136057409796709131975934819546351645648023426109724822222021076945516529523908135087914149158913039621106870086438694594645527657207407820621743379988141063267329253552286881372149012981122451451889849057222307285255133155755015914397476397983411801999323962548289017107081850690630666655994938275772572015763062708408680088897643659848849296818931938938866700089218944638437937376338339813008209813048416108236553223716718466478446628626929458617406508398924853920981117812834574394614516963226013779566640451098787066697209591919016181015148744476302066227099922604920521093546347009262591097638416e-308",
+    NULL,
+};
+
+static const char* LONG_DIGITS[] = {
+    "1234567890123456789",
+    "12345678901234567890",
+    "123456789012345678901234567890",
+    "18446744073709551615",
+    "18446744073709551616",
+    "0.1234567890123456789012345",
+    "0.000000000000000000000000000000000001234567890123456789012345",
+    "00000000000000000000000000000000001.5",
+    "1.00000000000000000000000000000000000000000000001",
+    "9999999999999999999999999999999999999e-20",
+    "179769313486231580793728971405303415079934132710037826936173778980444968292764750946649017977587207096330286416692887910946555547851940402630657488671505820681908902000708383676273854845817711531764475730270069855571366959622842914819860834936475292719074168444365510704342711559699508093042880177904174497791.9999999999",
+    NULL,
+};
+
+static const char* INF_NAN[] = {
+    "inf",
+    "-inf",
+    "+INF",
+    "Infinity",
+    "-Infinity",
+    "infinit",
+    "nan",
+    "-NaN",
+    "NaN(12)",
+    "nan(",
+    "1e308",
+    "1.7976931348623157e308",
+    "1.7976931348623159e308",
+    "2e308",
+    "1e400",
+    NULL,
+};
+
+static const char* HEX[] = {
+    "0x1p3",
+    "0X10",
+    "0x",
+    "0x.8",
+    "-0x1.8p-2",
+    "0x1.fffffffffffffp1023",
+    "0x1p-1074",
+    "0x1p-1075",
+    "0x1.00000000000008p0",
+    "0x1.00000000000018p0",
+    "0xg",
+    NULL,
+};
+
+static const char* MALFORMED[] = {
+    "",
+    "0",
+    "-0",
+    "+0",
+    ".",
+    "-",
+    "1.",
+    ".5",
+    "1e",
+    "1e+",
+    "1e-",
+    "1e5x",
+    " 12",
+    "\t-3.5",
+    "1,5",
+    "1.5.5",
+    "--1",
+    "+-1",
+    "0.1",
+    "1e23",
+    "1e-22",
+    "1e22",
+    "12.5e-1",
+    NULL,
+};
+
+static uint64_t s_rand;
+static long s_checked = 0;
+static long s_failed = 0;
+
+static uint64_t next_rand(void)
+{
+    s_rand ^= s_rand << 13;
+    s_rand ^= s_rand >> 7;
+    s_rand ^= s_rand << 17;
+    return s_rand;
+}
+
+static double random_double(void)
+{
+    uint64_t bits = next_rand();
+    double d;
+    memcpy(&d, &bits, sizeof d);
+    return d;
+}
+
+static void check(const char* s)
+{
+    size_t len = strlen(s);
+    double want = strtod(s, NULL);
+    // digits after the span make sure it is not read past
+    char buf[4096];
+    if (len + 3 > sizeof buf)
+        return;
+    memcpy(buf, s, len);
+    memcpy(buf + len, "79", 3);
+    double got = gram_csv_parse_double(buf, len);
+    s_checked++;
+    if (memcmp(&want, &got, sizeof want) == 0 || (isnan(want) && isnan(got)))
+        return;
+    if (s_failed++ < MAX_REPORTED)
+        printf("mismatch `%s`: strtod %a, gram_csv_parse_double %a\n", s, want, got);
+}
+
+static void check_all(const char* name, const char** cases)
+{
+    long failed = s_failed;
+    for (size_t i = 0; cases[i]; i++) {
+        check(cases[i]);
+    }
+    printf("%s: %ld mismatches\n", name, s_failed - failed);
+}
+
+/// the exact decimal expansion of the midpoint between a random double and the next one
+static void check_random_halfway(char* s, size_t sz)
+{
+    double d = fabs(random_double());
+    double next = nextafter(d, INFINITY);
+    if (isinf(d) || isnan(d) || isinf(next))
+        return;
+    long double mid = ((long double)d + next) / 2;
+    snprintf(s, sz, "%.40Le", mid);
+    check(s);
+}
+
+static void check_random(long n)
+{
+    long failed = s_failed;
+    char s[512];
+    for (long i = 0; i < n; i++) {
+        double d = random_double();
+        switch (next_rand() % 6) {
+        case 0:
+            snprintf(s, sizeof s, "%.17g", d);
+            break;
+        case 1:
+            snprintf(s, sizeof s, "%.*e", (int)(next_rand() % 20), d);
+            break;
+        case 2:
+            snprintf(s, sizeof s, "%s%llu.%llu", next_rand() % 2 ? "-" : "",
+                (unsigned long long)(next_rand() % 100000), (unsigned long long)(next_rand() % 1000000));
+            break;
+        case 3: {
+            // up to 40 digits with the point anywhere
+            int digits = 1 + next_rand() % 40;
+            int point = next_rand() % digits;
+            int k = 0;
+            for (int j = 0; j < digits; j++) {
+                s[k++] = '0' + next_rand() % 10;
+                if (j == point)
+                    s[k++] = '.';
+            }
+            snprintf(s + k, sizeof s - k, "e%d", (int)(next_rand() % 700) - 350);
+        } break;
+        case 4:
+            snprintf(s, sizeof s, "%llue%d", (unsigned long long)(next_rand() >> (next_rand() % 64)),
+                (int)(next_rand() % 60) - 30);
+            break;
+        default:
+            d = ldexp((double)(next_rand() >> 11), (int)(next_rand() % 2100) - 1100);
+            snprintf(s, sizeof s, "%.*g", 15 + (int)(next_rand() % 4), d);
+            break;
+        }
+        if (isnan(d))
+            continue;
+        check(s);
+        if (i % 50 == 0)
+            check_random_halfway(s, sizeof s);
+    }
+    printf("random: %ld mismatches\n", s_failed - failed);
+}
+
+int main(int argc, char** argv)
+{
+    long n = argc > 1 ? strtol(argv[1], NULL, 10) : DEFAULT_RANDOM;
+    s_rand = argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_SEED;
+    if (!s_rand)
+        s_rand = DEFAULT_SEED;
+
+    check_all("halfway", HALFWAY);
+    check_all("subnormal", SUBNORMAL);
+    check_all("long digits", LONG_DIGITS);
+    check_all("inf/nan", INF_NAN);
+    check_all("hex", HEX);
+    check_all("malformed", MALFORMED);
+    check_random(n);
+
+    printf("%ld checked, %ld mismatches\n", s_checked, s_failed);
+    return s_failed != 0;
+}
@@ -0,0 +1,501 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gram_csv.h"
+
+// A generated header defines one struct object `D<GUARD>` with
+//   column_count, data_count   number of columns and rows
+//   min, max                   per column range in column order (exact hex floats)
+//   h<header>                  the values of every column, arrays of doubles or,
+//                              in blob mode, pointers into the embedded blob
+
+/// bytes formatted before they are handed to stdio
+#define OUT_BUF_SZ (1 << 16)
+/// room kept free for a single formatted value
+#define OUT_VALUE_SZ 512
+/// values per line of an initializer
+#define VALUES_PER_LINE 8
+/// rows converted at a time when a blob column is not stored as doubles
+#define BLOB_ROWS 4096
+
+typedef struct {
+    FILE* f;
+    size_t len;
+    char* buf;
+} csv_out_t;
+
+static void out_flush(csv_out_t* o)
+{
+    fwrite(o->buf, 1, o->len, o->f);
+    o->len = 0;
+}
+
+/// flushes and closes the file, returns 0 if everything was written
+static int out_close(csv_out_t* o)
+{
+    out_flush(o);
+    free(o->buf);
+    int failed = ferror(o->f);
+    failed |= fclose(o->f) != 0;
+    return failed ? GRAMCSV_ERR_COULD_NOT_OPEN_FILE : 0;
+}
+
+/// makes sure the next `n` bytes fit into the buffer
+static void out_reserve(csv_out_t* o, size_t n)
+{
+    if (o->len + n > OUT_BUF_SZ)
+        out_flush(o);
+}
+
+static void out_str(csv_out_t* o, const char* str)
+{
+    size_t len = strlen(str);
+    if (len > OUT_BUF_SZ / 2) {
+        out_flush(o);
+        fwrite(str, 1, len, o->f);
+        return;
+    }
+    out_reserve(o, len);
+    memcpy(o->buf + o->len, str, len);
+    o->len += len;
+}
+
+static void out_fmt(csv_out_t* o, const char* fmt, ...)
+{
+    out_reserve(o, OUT_VALUE_SZ);
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(o->buf + o->len, OUT_VALUE_SZ, fmt, args);
+    va_end(args);
+    o->len += n < OUT_VALUE_SZ ? n : OUT_VALUE_SZ - 1;
+}
+
+/// formats `v` as an exact C hexadecimal float literal (`%a` without going through printf),
+/// non finite values use the macros of <math.h>. Returns the length written to `dst` (at most 32)
+static size_t format_hex(double v, char* dst)
+{
+    static const char digits[] = "0123456789abcdef";
+    if (isnan(v)) {
+        memcpy(dst, "NAN", 3);
+        return 3;
+    }
+    if (isinf(v)) {
+        size_t n = v < 0 ? 9 : 8;
+        memcpy(dst, v < 0 ? "-INFINITY" : "INFINITY", n);
+        return n;
+    }
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof bits);
+    char* p = dst;
+    if (bits >> 63)
+        *p++ = '-';
+    int biased = (bits >> 52) & 0x7ff;
+    uint64_t mant = bits & ((1ull << 52) - 1);
+    if (!biased && !mant) {
+        memcpy(p, "0x0p+0", 6);
+        return p + 6 - dst;
+    }
+    // subnormals keep a leading 0 and the smallest exponent
+    int exp = biased ? biased - 1023 : -1022;
+    *p++ = '0';
+    *p++ = 'x';
+    *p++ = biased ? '1' : '0';
+    if (mant) {
+        *p++ = '.';
+        int shift = 48;
+        while (mant) {
+            *p++ = digits[(mant >> shift) & 0xf];
+            mant &= (1ull << shift) - 1;
+            shift -= 4;
+        }
+    }
+    *p++ = 'p';
+    *p++ = exp < 0 ? '-' : '+';
+    unsigned e = exp < 0 ? -exp : exp;
+    char rev[8];
+    size_t n = 0;
+    do {
+        rev[n++] = '0' + e % 10;
+        e /= 10;
+    } while (e);
+    while (n)
+        *p++ = rev[--n];
+    return p - dst;
+}
+
+static void out_hex(csv_out_t* o, double v)
+{
+    out_reserve(o, 32);
+    o->len += format_hex(v, o->buf + o->len);
+}
+
+/// writes `str` so that it survives `levels` rounds of string literal unescaping
+static void out_escaped(csv_out_t* o, const char* str, int levels)
+{
+    // every round turns `\\` into `\` and `\"` into `"`
+    size_t slashes = ((size_t)1 << levels) - 1;
+    for (; *str; str++) {
+        out_reserve(o, slashes + 1);
+        if (*str == '"' || *str == '\\') {
+            for (size_t i = 0; i < slashes; i++)
+                o->buf[o->len++] = '\\';
+        }
+        o->buf[o->len++] = *str;
+    }
+}
+
+static char* sanitize_guard(const char* str)
+{
+    if (!str)
+        return NULL;
+    size_t len = strlen(str);
+    if (len == 0) {
+        return NULL;
+    }
+    char* n_next = calloc(len + 1, sizeof(char));
+    size_t i = 0;
+    while (i < len) {
+        char c = str[i];
+        if (c == '.')
+            break;
+        if (!isalnum(c)) {
+            n_next[i] = '_';
+        } else {
+            n_next[i] = toupper(str[i]);
+        }
+        i++;
+    }
+    if (i == 0) {
+        free(n_next);
+        return NULL;
+    }
+    return n_next;
+}
+static char* sanitize_header(const char* str)
+{
+    if (!str)
+        return NULL;
+    size_t len = strlen(str);
+    if (len == 0) {
+        return NULL;
+    }
+    char* head = calloc(len + 1, sizeof(char));
+    size_t i = 0;
+    while (i < len) {
+        char c = str[i];
+        if (!isalnum(c) || isspace(c)) {
+            head[i] = '_';
+        } else {
+            head[i] = tolower(str[i]);
+        }
+        i++;
+    }
+    if (i == 0)
+        return NULL;
+    return head;
+}
+
+/// name the generated header gives to everything it defines, free it after use
+static char* dataset_guard(const CSVFile* csv)
+{
+    char* guard = sanitize_guard(csv->file_name);
+    return guard ? guard : strdup("UNNAMED");
+}
+
+/// struct member name of column `h`, free it after use
+static char* member_name(const CSVFile* csv, size_t h)
+{
+    char* header = sanitize_header(csv->headers[h]);
+    if (header)
+        return header;
+    // columns without a name are told apart by their index
+    char* name = calloc(32, sizeof(char));
+    snprintf(name, 32, "_%zu", h);
+    return name;
+}
+
+char* gram_csv_blob_path(const char* header_file)
+{
+    size_t len = strlen(header_file);
+    if (len > 2 && strcmp(header_file + len - 2, ".h") == 0)
+        len -= 2;
+    char* path = calloc(len + sizeof ".bin", sizeof(char));
+    memcpy(path, header_file, len);
+    strcpy(path + len, ".bin");
+    return path;
+}
+
+/// writes every column as native doubles one after the other, returns 0 if no error
+static int write_blob(const CSVFile* csv, const char* blob_file)
+{
+    FILE* f = fopen(blob_file, "wb");
+    if (!f)
+        return GRAMCSV_ERR_COULD_NOT_OPEN_FILE;
+    double* rows = malloc(BLOB_ROWS * sizeof(double));
+    for (size_t c = 0; c < csv->col_count; c++) {
+        if (gram_csv_column_type(csv, c) == GRAMCSV_TYPE_DOUBLE) {
+            fwrite(csv->columns[c], sizeof(double), csv->col_len, f);
+            continue;
+        }
+        for (size_t r = 0; r < csv->col_len; r += BLOB_ROWS) {
+            size_t n = csv->col_len - r < BLOB_ROWS ? csv->col_len - r : BLOB_ROWS;
+            gram_csv_read_column(csv, c, r, n, rows);
+            fwrite(rows, sizeof(double), n, f);
+        }
+    }
+    free(rows);
+    int failed = ferror(f);
+    failed |= fclose(f) != 0;
+    return failed ? GRAMCSV_ERR_COULD_NOT_OPEN_FILE : 0;
+}
+
+/// declares `_gram_blob_<guard>` holding the contents of `blob_file`. `#embed` finds the blob
+/// next to the header, the `.incbin` fallback needs its absolute path
+static void out_blob_decl(csv_out_t* o, const CSVFile* csv, const char* guard, const char* blob_file)
+{
+    size_t values = csv->col_count * csv->col_len;
+    const char* sep = strrchr(blob_file, '/');
+    char* abs_path = realpath(blob_file, NULL);
+
+    out_str(o, "#if defined(__has_embed)\n");
+    // reading the doubles through the union is well defined, unlike casting the bytes
+    out_fmt(o, "static const union {\n\t unsigned char bytes[%zu];\n\t double values[%zu];\n} _gram_blob_%s = { .bytes = {\n",
+        values * sizeof(double) + !values, values + !values, guard);
+    out_str(o, "#embed \"");
+    out_escaped(o, sep ? sep + 1 : blob_file, 0);
+    out_str(o, "\"\n} };\n");
+    out_fmt(o, "#define _GRAM_BLOB_%s _gram_blob_%s.values\n", guard, guard);
+    out_str(o, "#else\n");
+    out_str(o, "__asm__(\".pushsection .rodata\\n\"\n");
+    out_str(o, "\t\".balign 64\\n\"\n");
+    out_fmt(o, "\t\".globl _gram_blob_%s\\n\"\n", guard);
+    out_fmt(o, "\t\".hidden _gram_blob_%s\\n\"\n", guard);
+    out_fmt(o, "\t\"_gram_blob_%s:\\n\"\n", guard);
+    out_str(o, "\t\".incbin \\\"");
+    out_escaped(o, abs_path ? abs_path : blob_file, 2);
+    out_str(o, "\\\"\\n\"\n");
+    out_str(o, "\t\".popsection\\n\");\n");
+    out_fmt(o, "extern const double _gram_blob_%s[] __attribute__((visibility(\"hidden\")));\n", guard);
+    out_fmt(o, "#define _GRAM_BLOB_%s _gram_blob_%s\n", guard, guard);
+    out_str(o, "#endif\n");
+    free(abs_path);
+}
+
+int gram_csv_write_header(CSVFile* csv, const char* header_file, GramCsvHeaderMode mode)
+{
+    char* blob_file = NULL;
+    if (mode == GRAMCSV_HEADER_BLOB) {
+        blob_file = gram_csv_blob_path(header_file);
+        int err = write_blob(csv, blob_file);
+        if (err) {
+            free(blob_file);
+            return err;
+        }
+    }
+    FILE* f = fopen(header_file, "w");
+    if (!f) {
+        free(blob_file);
+        return GRAMCSV_ERR_COULD_NOT_OPEN_FILE;
+    }
+    csv_out_t out = { .f = f, .buf = malloc(OUT_BUF_SZ) };
+    csv_out_t* o = &out;
+    char* guard = dataset_guard(csv);
+    out_fmt(o, "#ifndef _%s_DATASET_H\n"
+               "#define _%s_DATASET_H\n",
+        guard, guard);
+    // for non finite min, max and values
+    out_str(o, "#include <math.h>\n");
+    if (mode == GRAMCSV_HEADER_BLOB)
+        out_blob_decl(o, csv, guard, blob_file);
+
+    // define the struct
+    out_fmt(o, "struct _gram_dataset_%s {\n", guard);
+    out_str(o, "\t unsigned long column_count;\n");
+    out_str(o, "\t unsigned long data_count;\n");
+    out_fmt(o, "\t double min[%zu];\n", csv->col_count);
+    out_fmt(o, "\t double max[%zu];\n", csv->col_count);
+
+    for (size_t h = 0; h < csv->header_count; h++) {
+        char* header = member_name(csv, h);
+        if (mode == GRAMCSV_HEADER_BLOB) {
+            out_fmt(o, "\t const double* h%s;\n", header);
+        } else {
+            out_fmt(o, "\t double h%s[%ld];\n", header, csv->col_len);
+        }
+        free(header);
+    }
+    out_fmt(o, "} D%s = {\n", guard);
+
+    out_fmt(o, "\t .column_count = %ld,\n", csv->col_count);
+    out_fmt(o, "\t .data_count = %ld,\n", csv->col_len);
+    // the range is known here, so users of the header never scan the data for it
+    double* min = calloc(csv->col_count + 1, sizeof(double));
+    double* max = calloc(csv->col_count + 1, sizeof(double));
+    for (size_t c = 0; c < csv->col_count; c++) {
+        gram_csv_column_range(csv, c, &min[c], &max[c]);
+    }
+    for (int m = 0; m < 2; m++) {
+        out_str(o, m ? "\t .max = { " : "\t .min = { ");
+        for (size_t c = 0; c < csv->col_count; c++) {
+            out_hex(o, m ? max[c] : min[c]);
+            out_str(o, c + 1 < csv->col_count ? ", " : " ");
+        }
+        out_str(o, "},\n");
+    }
+    free(min);
+    free(max);
+
+    // initialize columns
+    for (size_t h = 0; h < csv->header_count; h++) {
+        char* header = member_name(csv, h);
+        if (mode == GRAMCSV_HEADER_BLOB) {
+            out_fmt(o, "\t .h%s = &_GRAM_BLOB_%s[%zu],\n", header, guard, h * csv->col_len);
+            free(header);
+            continue;
+        }
+        out_fmt(o, "\t .h%s = {\n\t\t", header);
+        free(header);
+        for (size_t i = 0; i < csv->col_len; i++) {
+            double v = gram_csv_value(csv, h, i);
+            if (mode == GRAMCSV_HEADER_TEXT) {
+                out_fmt(o, "%lf", v);
+            } else {
+                out_hex(o, v);
+            }
+            if (i != csv->col_len - 1) {
+                out_str(o, mode == GRAMCSV_HEADER_TEXT || (i + 1) % VALUES_PER_LINE ? ", " : ",\n\t\t");
+            }
+        }
+        out_str(o, "\n\t},\n");
+    }
+    out_str(o, "\n};\n");
+
+    free(guard);
+    out_str(o, "#endif\n");
+    free(blob_file);
+    return out_close(o);
+}
+
+void gram_csv_write_header_file(CSVFile* csv, const char* header_file)
+{
+    gram_csv_write_header(csv, header_file, GRAMCSV_HEADER_TEXT);
+}
+
+char* gram_csv_plugin_path(const char* plugin_file, const char* suffix)
+{
+    size_t len = strlen(plugin_file);
+    if (len > 2 && strcmp(plugin_file + len - 2, ".c") == 0)
+        len -= 2;
+    char* path = calloc(len + strlen(suffix) + 1, sizeof(char));
+    memcpy(path, plugin_file, len);
+    strcpy(path + len, suffix);
+    return path;
+}
+
+/// `path` without its directory
+static const char* base_name(const char* path)
+{
+    const char* sep = strrchr(path, '/');
+    return sep ? sep + 1 : path;
+}
+
+/// the plugin functions `load_from_so` looks up, `gram_update` copies row `t` of every column
+static int write_plugin_source(const CSVFile* csv, const char* plugin_file, const char* header_file)
+{
+    FILE* f = fopen(plugin_file, "w");
+    if (!f)
+        return GRAMCSV_ERR_COULD_NOT_OPEN_FILE;
+    csv_out_t out = { .f = f, .buf = malloc(OUT_BUF_SZ) };
+    csv_out_t* o = &out;
+    char* guard = dataset_guard(csv);
+
+    out_fmt(o, "// generated by gram_csv from `%s`, the data is served from static memory\n", csv->file_name ? csv->file_name : "");
+    out_str(o, "#include \"gram.h\"\n#include <stddef.h>\n#include \"");
+    out_escaped(o, base_name(header_file), 0);
+    out_str(o, "\"\n\n");
+    out_fmt(o, "#define DIM %zu\n#define TIME %zu\n#define STEP 1\n#define START_AT 0\n\n", csv->col_count, csv->col_len);
+
+    out_str(o, "/// called TIME times with `t = [0..TIME]`, `ret` gets row `t` of every column\n");
+    out_str(o, "void gram_update(float t, float* ret)\n{\n");
+    out_str(o, "    size_t row = (size_t)t;\n    if (row >= TIME)\n        return;\n");
+    for (size_t h = 0; h < csv->col_count; h++) {
+        char* header = member_name(csv, h);
+        out_fmt(o, "    ret[%zu] = D%s.h%s[row];\n", h, guard, header);
+        free(header);
+    }
+    out_str(o, "}\n");
+    out_str(o, "/// same as `gram_update` for `n` samples, those of `t[i]` go to `out[i * stride ..]`\n");
+    out_str(o, "void gram_update_batch(const float* t, size_t n, float* out, size_t stride)\n{\n");
+    out_str(o, "    for (size_t i = 0; i < n; i++) {\n        size_t row = (size_t)t[i];\n");
+    out_str(o, "        if (row >= TIME)\n            continue;\n");
+    for (size_t h = 0; h < csv->col_count; h++) {
+        char* header = member_name(csv, h);
+        out_fmt(o, "        out[i * stride + %zu] = D%s.h%s[row];\n", h, guard, header);
+        free(header);
+    }
+    out_str(o, "    }\n}\n");
+    out_str(o, "/// the values only depend on `t`\n");
+    out_str(o, "int gram_get_flags(void)\n{\n    return GRAM_FLAG_PURE;\n}\n");
+    out_str(o, "int gram_get_draw_type(void)\n{\n    return GRAM_DRAW_LINE;\n}\n");
+    out_str(o, "size_t gram_get_time(void)\n{\n    return TIME;\n}\n");
+    out_str(o, "int gram_get_start_at(void)\n{\n    return START_AT;\n}\n");
+    out_str(o, "size_t gram_get_dimensions(void)\n{\n    return DIM;\n}\n");
+    out_str(o, "float gram_get_step(void)\n{\n    return STEP;\n}\n");
+    out_str(o, "GramColorScheme* gram_get_color_scheme(void)\n{\n    return NULL; // default scheme\n}\n");
+    out_str(o, "/// smallest value of dimension `dim` over all samples\n");
+    out_fmt(o, "double gram_get_min(size_t dim)\n{\n    return dim < DIM ? D%s.min[dim] : 0;\n}\n", guard);
+    out_str(o, "/// largest value of dimension `dim` over all samples\n");
+    out_fmt(o, "double gram_get_max(size_t dim)\n{\n    return dim < DIM ? D%s.max[dim] : 0;\n}\n", guard);
+    out_str(o, "void gram_init(void) { }\n");
+    out_str(o, "void gram_fini(void) { }\n");
+
+    free(guard);
+    return out_close(o);
+}
+
+/// a SHARED target like `gram_update` for the plugin, meant to be `include()`d by gram's CMakeLists.txt
+static int write_plugin_cmake(const CSVFile* csv, const char* cmake_file, const char* plugin_file, const char* blob_file)
+{
+    FILE* f = fopen(cmake_file, "w");
+    if (!f)
+        return GRAMCSV_ERR_COULD_NOT_OPEN_FILE;
+    csv_out_t out = { .f = f, .buf = malloc(OUT_BUF_SZ) };
+    csv_out_t* o = &out;
+    // the target is named after the plugin source
+    char* stem = gram_csv_plugin_path(base_name(plugin_file), "");
+    char* target = sanitize_header(stem);
+
+    out_fmt(o, "# generated by gram_csv from `%s`, include() it from gram's CMakeLists.txt and build\n", csv->file_name ? csv->file_name : "");
+    out_fmt(o, "# the `%s` target to get lib%s.so for `gram -s`\n", target ? target : "gram_data", target ? target : "gram_data");
+    out_fmt(o, "add_library(%s SHARED EXCLUDE_FROM_ALL\n", target ? target : "gram_data");
+    out_fmt(o, "    \"${CMAKE_CURRENT_LIST_DIR}/%s\"\n)\n", base_name(plugin_file));
+    if (blob_file) {
+        // nothing in the source names the blob, so the build would not notice it changing
+        out_fmt(o, "set_source_files_properties(\"${CMAKE_CURRENT_LIST_DIR}/%s\"\n", base_name(plugin_file));
+        out_fmt(o, "    PROPERTIES OBJECT_DEPENDS \"${CMAKE_CURRENT_LIST_DIR}/%s\"\n)\n", base_name(blob_file));
+    }
+
+    free(stem);
+    free(target);
+    return out_close(o);
+}
+
+int gram_csv_write_plugin(CSVFile* csv, const char* plugin_file, GramCsvHeaderMode mode)
+{
+    char* header_file = gram_csv_plugin_path(plugin_file, "_data.h");
+    char* cmake_file = gram_csv_plugin_path(plugin_file, ".cmake");
+    char* blob_file = mode == GRAMCSV_HEADER_BLOB ? gram_csv_blob_path(header_file) : NULL;
+    int err = gram_csv_write_header(csv, header_file, mode);
+    if (!err)
+        err = write_plugin_source(csv, plugin_file, header_file);
+    if (!err)
+        err = write_plugin_cmake(csv, cmake_file, plugin_file, blob_file);
+    free(header_file);
+    free(cmake_file);
+    free(blob_file);
+    return err;
+}
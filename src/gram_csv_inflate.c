@@ -0,0 +1,243 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "gram_csv_inflate.h"
+#ifdef GRAMCSV_GZIP
+#include <zlib.h>
+#endif
+#ifdef GRAMCSV_ZSTD
+#include <zstd.h>
+#endif
+
+/// blocks in flight between the decompressing thread and the parser
+#define INFLATE_BLOCKS 4
+#define INFLATE_BLOCK_SZ (1 << 22)
+
+struct csv_inflate {
+    const unsigned char* data;
+    size_t len;
+    csv_compression_t kind;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char* blocks[INFLATE_BLOCKS];
+    size_t lens[INFLATE_BLOCKS];
+    /// block the reader is at and the number of filled blocks starting there
+    size_t head;
+    size_t filled;
+    /// the reader holds the block at `head`, it is given back by the next `csv_inflate_next`
+    int holding;
+    int done;
+    int stop;
+    int err;
+};
+
+csv_compression_t csv_compression(const char* data, size_t len)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    if (len >= 2 && p[0] == 0x1f && p[1] == 0x8b)
+        return CSV_GZIP;
+    if (len >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd)
+        return CSV_ZSTD;
+    return CSV_PLAIN;
+}
+
+const char* csv_compression_name(csv_compression_t kind)
+{
+    switch (kind) {
+    case CSV_GZIP:
+        return "gzip";
+    case CSV_ZSTD:
+        return "zstd";
+    default:
+        return "plain";
+    }
+}
+
+#if defined(GRAMCSV_GZIP) || defined(GRAMCSV_ZSTD)
+/// waits for a free block, returns NULL if the reader asked to stop
+static char* block_take(csv_inflate_t* z)
+{
+    pthread_mutex_lock(&z->lock);
+    while (z->filled == INFLATE_BLOCKS && !z->stop)
+        pthread_cond_wait(&z->cond, &z->lock);
+    char* block = z->stop ? NULL : z->blocks[(z->head + z->filled) % INFLATE_BLOCKS];
+    pthread_mutex_unlock(&z->lock);
+    return block;
+}
+
+/// hands the block taken last over to the reader
+static void block_put(csv_inflate_t* z, size_t len)
+{
+    if (!len)
+        return;
+    pthread_mutex_lock(&z->lock);
+    z->lens[(z->head + z->filled) % INFLATE_BLOCKS] = len;
+    z->filled++;
+    pthread_cond_broadcast(&z->cond);
+    pthread_mutex_unlock(&z->lock);
+}
+#endif
+
+#ifdef GRAMCSV_GZIP
+/// returns 0 if the data was intact (or the reader stopped early)
+static int inflate_gzip(csv_inflate_t* z)
+{
+    z_stream s = { 0 };
+    // 32 makes zlib read the gzip header
+    if (inflateInit2(&s, 15 + 32) != Z_OK)
+        return 1;
+    size_t in = 0;
+    int ret = Z_OK;
+    char* block;
+    while ((block = block_take(z))) {
+        s.next_out = (unsigned char*)block;
+        s.avail_out = INFLATE_BLOCK_SZ;
+        while (s.avail_out) {
+            if (!s.avail_in && in < z->len) {
+                size_t n = z->len - in < UINT_MAX ? z->len - in : UINT_MAX;
+                s.next_in = (unsigned char*)z->data + in;
+                s.avail_in = n;
+                in += n;
+            }
+            ret = inflate(&s, Z_NO_FLUSH);
+            // concatenated gzip members make up a single file
+            if (ret == Z_STREAM_END && (s.avail_in || in < z->len)) {
+                ret = inflateReset(&s);
+                continue;
+            }
+            if (ret != Z_OK)
+                break;
+        }
+        block_put(z, INFLATE_BLOCK_SZ - s.avail_out);
+        if (ret != Z_OK)
+            break;
+    }
+    inflateEnd(&s);
+    return block && ret != Z_STREAM_END;
+}
+#endif
+
+#ifdef GRAMCSV_ZSTD
+/// returns 0 if the data was intact (or the reader stopped early)
+static int inflate_zstd(csv_inflate_t* z)
+{
+    ZSTD_DCtx* d = ZSTD_createDCtx();
+    if (!d)
+        return 1;
+    ZSTD_inBuffer in = { .src = z->data, .size = z->len };
+    // 0 once the last frame is complete
+    size_t ret = 1;
+    char* block;
+    while ((block = block_take(z))) {
+        ZSTD_outBuffer out = { .dst = block, .size = INFLATE_BLOCK_SZ };
+        // with the input used up, a block that is not full means the decoder has flushed everything
+        while (out.pos < out.size) {
+            ret = ZSTD_decompressStream(d, &out, &in);
+            if (ZSTD_isError(ret) || (in.pos == in.size && out.pos < out.size))
+                break;
+        }
+        block_put(z, out.pos);
+        if (ZSTD_isError(ret) || (in.pos == in.size && out.pos < out.size))
+            break;
+    }
+    ZSTD_freeDCtx(d);
+    return block && ret != 0;
+}
+#endif
+
+static void* inflate_worker(void* arg)
+{
+    csv_inflate_t* z = arg;
+    int err = 1;
+#ifdef GRAMCSV_GZIP
+    if (z->kind == CSV_GZIP)
+        err = inflate_gzip(z);
+#endif
+#ifdef GRAMCSV_ZSTD
+    if (z->kind == CSV_ZSTD)
+        err = inflate_zstd(z);
+#endif
+    pthread_mutex_lock(&z->lock);
+    z->err = err && !z->stop;
+    z->done = 1;
+    pthread_cond_broadcast(&z->cond);
+    pthread_mutex_unlock(&z->lock);
+    return NULL;
+}
+
+int csv_inflate_supported(csv_compression_t kind)
+{
+    (void)kind;
+    int supported = 0;
+#ifdef GRAMCSV_GZIP
+    supported |= kind == CSV_GZIP;
+#endif
+#ifdef GRAMCSV_ZSTD
+    supported |= kind == CSV_ZSTD;
+#endif
+    return supported;
+}
+
+csv_inflate_t* csv_inflate_start(const char* data, size_t len, csv_compression_t kind)
+{
+    if (!csv_inflate_supported(kind))
+        return NULL;
+    csv_inflate_t* z = calloc(1, sizeof(csv_inflate_t));
+    z->data = (const unsigned char*)data;
+    z->len = len;
+    z->kind = kind;
+    pthread_mutex_init(&z->lock, NULL);
+    pthread_cond_init(&z->cond, NULL);
+    for (size_t i = 0; i < INFLATE_BLOCKS; i++) {
+        z->blocks[i] = malloc(INFLATE_BLOCK_SZ);
+    }
+    if (pthread_create(&z->thread, NULL, inflate_worker, z)) {
+        for (size_t i = 0; i < INFLATE_BLOCKS; i++) {
+            free(z->blocks[i]);
+        }
+        pthread_mutex_destroy(&z->lock);
+        pthread_cond_destroy(&z->cond);
+        free(z);
+        return NULL;
+    }
+    return z;
+}
+
+size_t csv_inflate_next(csv_inflate_t* z, const char** block)
+{
+    pthread_mutex_lock(&z->lock);
+    if (z->holding) {
+        z->head = (z->head + 1) % INFLATE_BLOCKS;
+        z->filled--;
+        z->holding = 0;
+        pthread_cond_broadcast(&z->cond);
+    }
+    while (!z->filled && !z->done)
+        pthread_cond_wait(&z->cond, &z->lock);
+    size_t len = 0;
+    if (z->filled) {
+        z->holding = 1;
+        *block = z->blocks[z->head];
+        len = z->lens[z->head];
+    }
+    pthread_mutex_unlock(&z->lock);
+    return len;
+}
+
+int csv_inflate_finish(csv_inflate_t* z)
+{
+    pthread_mutex_lock(&z->lock);
+    z->stop = !z->done;
+    pthread_cond_broadcast(&z->cond);
+    pthread_mutex_unlock(&z->lock);
+    pthread_join(z->thread, NULL);
+    int err = z->err || z->stop;
+    for (size_t i = 0; i < INFLATE_BLOCKS; i++) {
+        free(z->blocks[i]);
+    }
+    pthread_mutex_destroy(&z->lock);
+    pthread_cond_destroy(&z->cond);
+    free(z);
+    return err;
+}
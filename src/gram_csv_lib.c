@@ -1,9 +1,18 @@
-#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "gram_csv.h"
+#include "gram_csv_arena.h"
+#include "gram_csv_column.h"
+#include "gram_csv_float.h"
+#include "gram_csv_inflate.h"
+#include "gram_csv_scan.h"
 
 #define BUF_PUSH(VAL, BUF, BUFPTR, SIZE, OFTYPE)   \
     if (BUFPTR + 1 >= SIZE) {                      \
@@ -12,19 +21,68 @@
     }                                              \
     BUF[BUFPTR++] = VAL
 
-#define SET_ERR(FMT, ...) \
-    sprintf(__errbuf, #FMT ,##__VA_ARGS__ )
+#define SET_ERR(BUF, FMT, ...) \
+    snprintf(BUF, ERRBUF_SZ, FMT, ##__VA_ARGS__)
 
 #define COMMA ','
 #define QUOTE '"'
 #define NEWLINE '\n'
 #define CARRIAGERETURN '\r'
 
-static char __errbuf[256] = { 0 };
+#define ERRBUF_SZ GRAMCSV_ERR_MSG_SZ
+/// files smaller than this per thread are not worth splitting
+#ifndef MIN_CHUNK_SZ
+#define MIN_CHUNK_SZ (1 << 22)
+#endif
+#define MAX_THREADS 64
+/// rows per batch handed from the tokenizer to the column builder
+#define BATCH_ROWS 4096
+/// how much of the mapping a stream parses before dropping it from memory
+#define RELEASE_SZ (1 << 24)
+/// size of the blocks segments keep their parsed rows in
+#define ARENA_BLOCK_SZ (1 << 22)
+/// records looked at to tell text columns from numeric ones
+#define SAMPLE_ROWS 256
+/// rows a followed file has room for before its columns are first reallocated
+#define FOLLOW_MIN_ROWS 4096
 
+/// backs the parser-less compatibility API
+static _Thread_local GramCsvParser default_parser = { 0 };
 
-static size_t line_count = 0;
-static int IS_EOF = 0;
+/// a field inside of the mapped file, never NUL terminated
+typedef struct {
+    const char* ptr;
+    size_t len;
+    /// field was quoted and contains escaped (doubled) quotes
+    int escaped;
+} span_t;
+
+/// tokenizer state over a memory mapped csv file
+typedef struct {
+    const char* begin;
+    const char* cur;
+    const char* end;
+    csv_scanner_t scan;
+    size_t line_count;
+    int eof;
+    char* errbuf;
+    /// give parsed pages of the mapping back to the kernel (streaming only)
+    int release;
+    const char* released;
+    /// bytes of the input before `begin`, when it is read a window at a time
+    size_t offset;
+    /// fields per record of the file
+    size_t header_count;
+    /// fields to keep (`keep[i]` non zero), the others are only counted. NULL keeps all
+    const unsigned char* keep;
+    /// fields of the current record, kept or not
+    size_t field_count;
+    size_t fields_p;
+    size_t fields_sz;
+    span_t* fields;
+    size_t scratch_sz;
+    char* scratch;
+} csv_reader_t;
 
 static char* get_file_name(const char* path)
 {
@@ -36,24 +94,56 @@ static char* get_file_name(const char* path)
             break;
         }
     }
-    char* n = calloc(len - i, sizeof(char));
+    char* n = calloc(len - i + 1, sizeof(char));
     strcpy(n, path + i);
     return n;
 }
+void gram_csv_parser_init(GramCsvParser* parser)
+{
+    *parser = (GramCsvParser) { 0 };
+}
+const char* gram_csv_parser_err_msg(const GramCsvParser* parser)
+{
+    return parser->err;
+}
 const char* gram_csv_err_msg(){
-    return __errbuf;
+    return gram_csv_parser_err_msg(&default_parser);
 }
 void gram_csv_csv_file_free(CSVFile csv)
 {
+    if (csv.mem) {
+        if (csv.map)
+            munmap(csv.map, csv.map_len);
+        free(csv.mem);
+        return;
+    }
     if (csv.file_name) {
         free(csv.file_name);
     }
-    for (size_t i = 0; i < csv.header_count; i++) {
+    for (size_t i = 0; csv.headers && i < csv.header_count; i++) {
         if (csv.headers[i]) {
             free(csv.headers[i]);
         }
     }
-    for (size_t i = 0; i < csv.col_count; i++) {
+    free(csv.headers);
+    // typed columns own their data, `columns` only points into it
+    for (size_t i = 0; csv.typed && i < csv.col_count; i++) {
+        for (size_t d = 0; !csv.map && d < csv.typed[i].dict_len; d++) {
+            free(csv.typed[i].dict[d]);
+        }
+        free(csv.typed[i].dict);
+        if (!csv.map)
+            free(csv.typed[i].data);
+    }
+    if (csv.map) {
+        munmap(csv.map, csv.map_len);
+    }
+    if (csv.map || csv.typed) {
+        free(csv.typed);
+        free(csv.columns);
+        return;
+    }
+    for (size_t i = 0; csv.columns && i < csv.col_count; i++) {
         if (csv.columns[i]) {
             free(csv.columns[i]);
         }
@@ -61,326 +151,1416 @@ void gram_csv_csv_file_free(CSVFile csv)
     free(csv.columns);
 }
 
+/// copies the field into `dst` collapsing escaped quotes, `dst` has to hold at least `s.len + 1` chars
+static size_t span_copy(span_t s, char* dst)
+{
+    if (!s.escaped) {
+        memcpy(dst, s.ptr, s.len);
+        dst[s.len] = '\0';
+        return s.len;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < s.len; i++) {
+        dst[n++] = s.ptr[i];
+        if (s.ptr[i] == QUOTE)
+            i++;
+    }
+    dst[n] = '\0';
+    return n;
+}
+
+static char* span_strdup(span_t s)
+{
+    char* str = calloc(s.len + 1, sizeof(char));
+    span_copy(s, str);
+    return str;
+}
 
-static void line_free(line_t l, size_t l_sz)
+/// returns the text of the field, only quoted fields with escaped quotes are copied (into `r->scratch`)
+static const char* span_text(csv_reader_t* r, span_t s, size_t* len)
 {
-    for (size_t i = 0; i < l_sz; i++) {
-        free(l[i]);
+    if (!s.escaped) {
+        *len = s.len;
+        return s.ptr;
     }
+    if (s.len + 1 > r->scratch_sz) {
+        while (s.len + 1 > r->scratch_sz)
+            r->scratch_sz *= 2;
+        r->scratch = realloc(r->scratch, r->scratch_sz);
+    }
+    *len = span_copy(s, r->scratch);
+    return r->scratch;
 }
 
-static char* read_quoted(FILE* f, size_t* line_len)
+/// parses the field in place
+static double span_to_double(csv_reader_t* r, span_t s)
 {
-    size_t start = *line_len;
-    int closed = 0;
-    size_t buf_p = 0;
-    size_t buf_sz = 128;
-    char* buf = calloc(buf_sz, sizeof(char));
-    int c = 0;
-    while ((c = fgetc(f)) != EOF) {
-        (*line_len)++;
-        // if quote is in the middle of the field
-        if (c == QUOTE) {
-            c = getc(f);
-            if (c == QUOTE) {
-                BUF_PUSH(c, buf, buf_p, buf_sz, char);
-                continue;
-            }
-            if (c == NEWLINE || c == COMMA || c == CARRIAGERETURN) {
-                closed = 1;
-                ungetc(c, f);
-                (*line_len)--;
-                break;
-            } else {
-                SET_ERR("Improper usage of quote (%ld:%ld)\n", line_count, *line_len);
-                free(buf);
-                return NULL;
-            }
-        } else {
-            BUF_PUSH(c, buf, buf_p, buf_sz, char);
+    size_t len = 0;
+    const char* text = span_text(r, s, &len);
+    return gram_csv_parse_double(text, len);
+}
+
+static void push_field(csv_reader_t* r, const char* ptr, size_t len, int escaped)
+{
+    size_t i = r->field_count++;
+    if (r->keep && (i >= r->header_count || !r->keep[i]))
+        return;
+    span_t s = { .ptr = ptr, .len = len, .escaped = escaped };
+    BUF_PUSH(s, r->fields, r->fields_p, r->fields_sz, span_t);
+}
+
+/// scans a quoted field starting at the opening quote `q`,
+/// returns a pointer to the closing quote or NULL on error
+static const char* read_quoted(csv_reader_t* r, const char* q, const char* line_start, int* escaped)
+{
+    const char* p = q + 1;
+    while (p < r->end) {
+        if (*p != QUOTE) {
+            p++;
+            continue;
         }
-    }
-    if (!closed) {
-        SET_ERR("Unclosed quotation (%ld:%ld)\n", line_count, start);
-        free(buf);
+        if (p + 1 == r->end) {
+            return p;
+        }
+        char n = p[1];
+        if (n == QUOTE) {
+            *escaped = 1;
+            p += 2;
+            continue;
+        }
+        if (n == NEWLINE || n == COMMA || n == CARRIAGERETURN) {
+            return p;
+        }
+        SET_ERR(r->errbuf, "Improper usage of quote (%zu:%zu)", r->line_count, (size_t)(p - line_start) + 1);
         return NULL;
     }
-    char* ret = calloc(buf_p + 1, sizeof(char));
-    memcpy(ret, buf, buf_p * sizeof(char));
-    free(buf);
-    return ret;
+    SET_ERR(r->errbuf, "Unclosed quotation (%zu:%zu)", r->line_count, (size_t)(q - line_start) + 1);
+    return NULL;
 }
 
-static line_t read_line(FILE* f, size_t* size)
+/// reads a single record into `r->fields` one character at a time,
+/// `*size` is set to 0 for empty lines, returns 0 if no error
+static int read_line_scalar(csv_reader_t* r, size_t* size)
 {
     *size = 0;
+    r->fields_p = 0;
+    r->field_count = 0;
+    const char* p = r->cur;
+    const char* line_start = p;
+    const char* field_start = p;
+    // the last field was quoted and has already been pushed
     int quoted = 0;
-    int c = 0;
-    size_t line_len = 0;
-
-    size_t fbuf_p = 0;
-    size_t fbuf_sz = 4;
-    char** fbuf = calloc(fbuf_sz, sizeof(char*));
-
-    size_t buf_p = 0;
-    size_t buf_sz = 512;
-    char* buf = calloc(buf_sz, sizeof(char));
 
     while (1) {
-        c = fgetc(f);
-        line_len++;
-        if (quoted && (c != COMMA && c != NEWLINE && c != CARRIAGERETURN && c != EOF)) {
-            SET_ERR("Improper quoting in field (%ld:%ld)\n", line_count, line_len);
-            free(buf);free(fbuf);
-            return NULL;
-        } else if (quoted && c == COMMA) {
+        if (p == r->end) {
+            if (!quoted && p > line_start) {
+                push_field(r, field_start, p - field_start, 0);
+            }
+            break;
+        }
+        char c = *p;
+        if (quoted && (c != COMMA && c != NEWLINE && c != CARRIAGERETURN)) {
+            SET_ERR(r->errbuf, "Improper quoting in field (%zu:%zu)", r->line_count, (size_t)(p - line_start) + 1);
+            return 1;
+        }
+        // fields can be empty
+        if (c == COMMA) {
+            if (!quoted) {
+                push_field(r, field_start, p - field_start, 0);
+            }
             quoted = 0;
+            field_start = ++p;
             continue;
-        } else if (quoted && (c == NEWLINE || c == EOF)) {
-            quoted = 0;
+        }
+        if (c == NEWLINE) {
+            if (!quoted && p > line_start) {
+                push_field(r, field_start, p - field_start, 0);
+            }
+            p++;
             break;
-        } else if (quoted && c == CARRIAGERETURN) {
-            c = fgetc(f);
-            if (c != NEWLINE) {
-                SET_ERR("Line ending not proper CRLF (CR present, but LF missing) (%ld:%ld)\n", line_count, line_len);
-                free(buf);free(fbuf);
-                return NULL;
+        }
+        if (c == CARRIAGERETURN) {
+            if (p + 1 == r->end || p[1] != NEWLINE) {
+                SET_ERR(r->errbuf, "Line ending not proper CRLF (CR present, but LF missing) (%zu:%zu)",
+                    r->line_count, (size_t)(p - line_start) + 1);
+                return 1;
             }
-            quoted = 0;
+            if (!quoted && p > line_start) {
+                push_field(r, field_start, p - field_start, 0);
+            }
+            p += 2;
             break;
         }
-        // fields can be empty
+        if (c == QUOTE) {
+            // if quote is in the middle of the field
+            if (p != field_start) {
+                SET_ERR(r->errbuf, "Quote start inside of field (%zu:%zu)", r->line_count, (size_t)(p - line_start) + 1);
+                return 1;
+            }
+            int escaped = 0;
+            const char* close = read_quoted(r, p, line_start, &escaped);
+            if (!close) {
+                return 1;
+            }
+            push_field(r, p + 1, close - p - 1, escaped);
+            quoted = 1;
+            p = close + 1;
+            continue;
+        }
+        p++;
+    }
+    r->cur = p;
+    r->line_count++;
+    r->eof = p == r->end;
+    *size = r->field_count;
+    return 0;
+}
+
+/// reads a single record into `r->fields` jumping between the structural characters found by the scanner,
+/// anything irregular is handed over to `read_line_scalar` so errors are reported the same way
+static int read_line(csv_reader_t* r, size_t* size)
+{
+    *size = 0;
+    r->fields_p = 0;
+    r->field_count = 0;
+    const char* end = r->end;
+    const char* line_start = r->cur;
+    const char* field_start = line_start;
+    const char* p = NULL;
+    // the last field was quoted and has already been pushed
+    int quoted = 0;
+
+    while (1) {
+        p = csv_scanner_next(&r->scan);
+        if (p == end) {
+            if (!quoted && p > line_start) {
+                push_field(r, field_start, p - field_start, 0);
+            }
+            break;
+        }
+        char c = *p;
         if (c == COMMA) {
-            char* field = calloc(buf_p + 1, sizeof(char));
-            memcpy(field, buf, buf_p);
-            memset(buf, 0, buf_p * sizeof(char));
-            buf_p = 0;
-            BUF_PUSH(field, fbuf, fbuf_p, fbuf_sz, char*);
+            if (!quoted) {
+                push_field(r, field_start, p - field_start, 0);
+            }
+            quoted = 0;
+            field_start = p + 1;
             continue;
         }
-        if (c == NEWLINE || c == EOF) {
-            if (line_len-1 > 0) {
-                char* field = calloc(buf_p + 1, sizeof(char));
-                memcpy(field, buf, buf_p);
-                memset(buf, 0, buf_p * sizeof(char));
-                buf_p = 0;
-                BUF_PUSH(field, fbuf, fbuf_p, fbuf_sz, char*);
+        if (c == NEWLINE) {
+            if (!quoted && p > line_start) {
+                push_field(r, field_start, p - field_start, 0);
             }
+            p++;
             break;
         }
         if (c == CARRIAGERETURN) {
-            c = fgetc(f);
-            if (c != NEWLINE) {
-                SET_ERR("Line ending not proper CRLF (CR present, but LF missing) (%ld:%ld)\n", line_count, line_len);
-                free(buf);free(fbuf);
-                return NULL;
+            if (p + 1 == end || p[1] != NEWLINE) {
+                goto fallback;
             }
-            if (line_len-1 > 0) {
-                char* field = calloc(buf_p + 1, sizeof(char));
-                memcpy(field, buf, buf_p);
-                memset(buf, 0, buf_p * sizeof(char));
-                buf_p = 0;
-                BUF_PUSH(field, fbuf, fbuf_p, fbuf_sz, char*);
+            if (!quoted && p > line_start) {
+                push_field(r, field_start, p - field_start, 0);
             }
+            // skip the LF
+            csv_scanner_next(&r->scan);
+            p += 2;
             break;
         }
-        // if quote is at the start of the field
-        if (c == QUOTE && buf_p == 0) {
-            char* field = read_quoted(f, &line_len);
-            if(!field){
-                free(buf);
-                free(fbuf);
-                return NULL;
+        // quotes are only allowed at the start of a field
+        if (quoted || p != field_start) {
+            goto fallback;
+        }
+        // delimiters inside of the quotes are masked out so the next structural character is a quote
+        int escaped = 0;
+        const char* close = NULL;
+        while (1) {
+            close = csv_scanner_next(&r->scan);
+            if (close == end) {
+                goto fallback;
             }
-            BUF_PUSH(field, fbuf, fbuf_p, fbuf_sz, char*);
-            quoted = 1;
+            if (close + 1 < end && close[1] == QUOTE) {
+                csv_scanner_next(&r->scan);
+                escaped = 1;
+                continue;
+            }
+            break;
+        }
+        if (close + 1 < end && close[1] != COMMA && close[1] != NEWLINE && close[1] != CARRIAGERETURN) {
+            goto fallback;
+        }
+        push_field(r, p + 1, close - p - 1, escaped);
+        quoted = 1;
+    }
+    r->cur = p;
+    r->line_count++;
+    r->eof = p == end;
+    *size = r->field_count;
+    return 0;
+
+fallback:
+    r->cur = line_start;
+    int err = read_line_scalar(r, size);
+    csv_scanner_init(&r->scan, r->cur, r->end, 0);
+    return err;
+}
+
+static void reader_init(csv_reader_t* r, const char* begin, const char* end, char* errbuf)
+{
+    *r = (csv_reader_t) {
+        .begin = begin,
+        .cur = begin,
+        .end = end,
+        .errbuf = errbuf,
+        .fields_sz = 16,
+        .fields = calloc(16, sizeof(span_t)),
+        .scratch_sz = 64,
+        .scratch = calloc(64, sizeof(char)),
+    };
+    csv_scanner_init(&r->scan, begin, end, 0);
+}
+
+static void reader_free(csv_reader_t* r)
+{
+    free(r->fields);
+    free(r->scratch);
+}
+
+/// hands the rows gathered in `batch` over to `fn`, returns non zero if it asked to stop
+static int flush_batch(csv_reader_t* r, GramCsvBatch* batch, gram_csv_batch_fn fn, void* user)
+{
+    batch->bytes_read = r->offset + (r->cur - r->begin);
+    if (fn(batch, user))
+        return 1;
+    batch->first_row += batch->rows;
+    batch->rows = 0;
+    // pages that were already parsed are not needed anymore
+    if (r->release && r->cur - r->released >= RELEASE_SZ) {
+        const char* upto = r->released + ((r->cur - r->released) / RELEASE_SZ) * RELEASE_SZ;
+        madvise((void*)r->released, upto - r->released, MADV_DONTNEED);
+        r->released = upto;
+    }
+    return 0;
+}
+
+/// reads the next record skipping empty lines, `*fields` is set to 0 at the end of the input.
+/// Returns 0 if no error
+static int read_record(csv_reader_t* r, size_t* fields)
+{
+    *fields = 0;
+    while (!r->eof) {
+        if (read_line(r, fields)) {
+            return GRAMCSV_ERR_READ_LINE;
+        }
+        if (!*fields)
             continue;
-        } else if (c == QUOTE && buf > 0) {
-            SET_ERR("Quote start inside of field (%ld:%ld)\n", line_count, line_len);
-            free(buf);
-            free(fbuf);
-            return NULL;
+        if (*fields != r->header_count) {
+            SET_ERR(r->errbuf, "Mismatch between the number (%zu) of fields in line (%zu) and the number of headers (%zu)",
+                *fields, r->line_count, r->header_count);
+            return GRAMCSV_ERR_IRREGULAR_FIELD_NUMBER;
         }
-        BUF_PUSH(c, buf, buf_p, buf_sz, char);
+        return 0;
     }
-    line_count++;
-    IS_EOF = c == EOF;
-    char** fields = NULL;
-    if (fbuf_p > 0) {
-        fields = calloc(fbuf_p, sizeof(char*));
-        memcpy(fields, fbuf, fbuf_p * sizeof(char*));
-        *size = fbuf_p;
+    return 0;
+}
+
+/// delivers the records of `r` to `fn` in batches of up to `batch_cap` rows, adding to the rows
+/// already in `batch`. With `more` set a partial last batch is kept for the records of the next range.
+/// `*stopped` is set if `fn` asked to stop, returns 0 if no error
+static int stream_records(csv_reader_t* r, GramCsvBatch* batch, size_t batch_cap, gram_csv_batch_fn fn, void* user,
+    int more, int* stopped)
+{
+    *stopped = 0;
+    while (1) {
+        size_t fields = 0;
+        int err = read_record(r, &fields);
+        if (err)
+            return err;
+        if (!fields)
+            break;
+        for (size_t i = 0; i < batch->header_count; i++) {
+            span_t field = r->fields[i];
+            batch->columns[i][batch->rows] = field.len ? span_to_double(r, field) : 0.0;
+        }
+        if (++batch->rows == batch_cap && flush_batch(r, batch, fn, user)) {
+            *stopped = 1;
+            return 0;
+        }
+    }
+    if (!more && batch->rows && flush_batch(r, batch, fn, user)) {
+        *stopped = 1;
     }
-    free(buf);
-    free(fbuf);
-    return fields;
+    return 0;
 }
 
-int gram_csv_load_csv(const char* csv_file, CSVFile* ret)
+static double** columns_alloc(size_t col_count, size_t rows)
 {
-    *ret = (CSVFile) { 0 };
-    FILE* csv = fopen(csv_file, "r");
-    if(!csv){
-        SET_ERR("Could not open file for reading");
-        return GRAMCSV_ERR_COULD_NOT_OPEN_FILE;
+    double** columns = calloc(col_count, sizeof(double*));
+    for (size_t i = 0; i < col_count; i++) {
+        columns[i] = (double*)calloc(rows ? rows : 1, sizeof(double));
+    }
+    return columns;
+}
+
+static void columns_free(double** columns, size_t col_count)
+{
+    if (!columns)
+        return;
+    for (size_t i = 0; i < col_count; i++) {
+        free(columns[i]);
+    }
+    free(columns);
+}
+
+/// storage picked for a column before parsing
+typedef struct {
+    GramCsvType type;
+    /// 0 lets a numeric column widen as needed
+    int fixed;
+} csv_type_t;
+
+/// a batch of rows kept by a segment, allocated from the segment arena
+typedef struct csv_chunk {
+    struct csv_chunk* next;
+    size_t rows;
+    double* columns[];
+} csv_chunk_t;
+
+/// the columns parsed out of a range of whole records
+typedef struct {
+    const char* begin;
+    const char* end;
+    /// fields per record and which of them end up in `columns`
+    size_t header_count;
+    const unsigned char* keep;
+    size_t col_count;
+    /// number of the first record in the range
+    size_t line_offset;
+    /// records read, including empty ones
+    size_t lines;
+    size_t rows;
+    /// batches of parsed rows in file order, the last one is being filled by `batch`
+    csv_arena_t arena;
+    csv_chunk_t* chunks;
+    csv_chunk_t* last;
+    GramCsvBatch* batch;
+    /// column types of a typed load (NULL for plain doubles) and the columns parsed with them
+    const csv_type_t* types;
+    csv_column_t* typed;
+    size_t quotes;
+    int err;
+    char errbuf[ERRBUF_SZ];
+} csv_segment_t;
+
+static void segment_free(csv_segment_t* seg)
+{
+    csv_arena_free(&seg->arena);
+    seg->chunks = NULL;
+    seg->last = NULL;
+    for (size_t i = 0; seg->typed && i < seg->col_count; i++) {
+        csv_column_free(&seg->typed[i]);
     }
-    char* file_name = get_file_name(csv_file);
-    char** headers = NULL;
-    size_t fields_per_record = 0;
+    free(seg->typed);
+    seg->typed = NULL;
+}
+
+/// appends an empty chunk of BATCH_ROWS rows to the segment
+static csv_chunk_t* chunk_new(csv_segment_t* seg)
+{
+    csv_chunk_t* chunk = csv_arena_alloc(&seg->arena, sizeof(csv_chunk_t) + seg->col_count * sizeof(double*),
+        sizeof(void*));
+    chunk->next = NULL;
+    chunk->rows = 0;
+    for (size_t i = 0; i < seg->col_count; i++) {
+        chunk->columns[i] = csv_arena_alloc(&seg->arena, BATCH_ROWS * sizeof(double), 64);
+    }
+    if (seg->last) {
+        seg->last->next = chunk;
+    } else {
+        seg->chunks = chunk;
+    }
+    seg->last = chunk;
+    return chunk;
+}
+
+/// keeps the batch that was just parsed into the last chunk and points the batch at a new one,
+/// rows are only copied once, into the final file
+static int segment_collect(const GramCsvBatch* batch, void* user)
+{
+    csv_segment_t* seg = user;
+    seg->last->rows = batch->rows;
+    seg->rows += batch->rows;
+    seg->batch->columns = chunk_new(seg)->columns;
+    return 0;
+}
+
+static void segment_init_typed(csv_segment_t* seg)
+{
+    seg->typed = calloc(seg->col_count ? seg->col_count : 1, sizeof(csv_column_t));
+    for (size_t i = 0; i < seg->col_count; i++) {
+        csv_column_init(&seg->typed[i], seg->types[i].type, seg->types[i].fixed);
+    }
+}
+
+/// parses every record of `r` into `seg->typed`, returns 0 if no error
+static int collect_typed(csv_segment_t* seg, csv_reader_t* r)
+{
     while (1) {
-        headers = read_line(csv, &fields_per_record);
-        if (headers)
+        size_t fields = 0;
+        int err = read_record(r, &fields);
+        if (err)
+            return err;
+        if (!fields)
             break;
-        if (IS_EOF) {
-            fclose(csv);
-            free(file_name);
-            SET_ERR("File was empty");
-            return GRAMCSV_ERR_FILE_EMPTY;
+        for (size_t i = 0; i < seg->col_count; i++) {
+            span_t field = r->fields[i];
+            csv_column_t* col = &seg->typed[i];
+            if (col->type != GRAMCSV_TYPE_DICT) {
+                csv_column_push_number(col, field.len ? span_to_double(r, field) : 0.0);
+                continue;
+            }
+            size_t len = 0;
+            const char* text = span_text(r, field, &len);
+            csv_column_push_text(col, text, len);
         }
+        seg->rows++;
     }
-    ret->file_name = file_name;
-    file_name = NULL;
+    return 0;
+}
+
+/// parses every record of `seg->begin..seg->end` into `seg->columns` (or `seg->typed`), returns 0 if no error
+static int parse_segment(csv_segment_t* seg)
+{
+    csv_reader_t r;
+    reader_init(&r, seg->begin, seg->end, seg->errbuf);
+    r.line_count = seg->line_offset;
+    r.eof = seg->begin == seg->end;
+    r.header_count = seg->header_count;
+    r.keep = seg->keep;
+
+    seg->rows = 0;
+    if (seg->types) {
+        segment_init_typed(seg);
+        seg->err = collect_typed(seg, &r);
+        seg->lines = r.line_count - seg->line_offset;
+        reader_free(&r);
+        if (seg->err)
+            segment_free(seg);
+        return seg->err;
+    }
+
+    // a segment that is parsed again starts over in the memory it already has
+    csv_arena_reset(&seg->arena);
+    seg->chunks = NULL;
+    seg->last = NULL;
+    GramCsvBatch batch = { .header_count = seg->col_count };
+    seg->batch = &batch;
+    batch.columns = chunk_new(seg)->columns;
+    int stopped = 0;
+    seg->err = stream_records(&r, &batch, BATCH_ROWS, segment_collect, seg, 0, &stopped);
+    seg->batch = NULL;
+    seg->lines = r.line_count - seg->line_offset;
+    reader_free(&r);
+    if (seg->err) {
+        segment_free(seg);
+    }
+    return seg->err;
+}
+
+static void* parse_segment_worker(void* arg)
+{
+    parse_segment(arg);
+    return NULL;
+}
+
+static void* count_quotes_worker(void* arg)
+{
+    csv_segment_t* seg = arg;
+    seg->quotes = csv_count_quotes(seg->begin, seg->end);
+    return NULL;
+}
+
+/// runs `fn` for every segment, segment 0 on the calling thread
+static void run_segments(csv_segment_t* segs, size_t n, void* (*fn)(void*))
+{
+    pthread_t threads[MAX_THREADS];
+    int started[MAX_THREADS] = { 0 };
+    for (size_t i = 1; i < n; i++) {
+        started[i] = pthread_create(&threads[i], NULL, fn, &segs[i]) == 0;
+        if (!started[i])
+            fn(&segs[i]);
+    }
+    fn(&segs[0]);
+    for (size_t i = 1; i < n; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+}
+
+/// returns the position right after the first LF outside of quotes in `p..end`, or `end`
+static const char* next_record(const char* p, const char* end, int in_quote)
+{
+    csv_scanner_t scan;
+    csv_scanner_init(&scan, p, end, in_quote);
+    const char* s;
+    while ((s = csv_scanner_next(&scan)) != end) {
+        if (*s == NEWLINE)
+            return s + 1;
+    }
+    return end;
+}
+
+/// returns the end of the last record ending in `from..end` (right after its LF), or NULL if none
+/// does. `*in_quote` tells whether `from` is inside a quoted field and is updated for `end`
+static const char* last_record_end(const char* from, const char* end, int* in_quote)
+{
+    size_t quotes = csv_count_quotes(from, end) + *in_quote;
+    *in_quote = quotes & 1;
+    const char* p = end;
+    while (p > from) {
+        char c = *--p;
+        // `quotes` counts the quotes up to `p`, a newline with an even count before it ends a record
+        if (c == QUOTE)
+            quotes--;
+        else if (c == NEWLINE && !(quotes & 1))
+            return p + 1;
+    }
+    return NULL;
+}
+
+/// returns the end of the last complete record in `begin..end` (right after its LF), or `begin`
+/// if there is none. `begin` has to be at a record boundary so the quote parity starts out even
+static const char* complete_end(const char* begin, const char* end)
+{
+    int in_quote = 0;
+    const char* p = last_record_end(begin, end, &in_quote);
+    return p ? p : begin;
+}
+
+static size_t thread_count(const GramCsvParser* parser, size_t data_len)
+{
+    long n = parser->threads;
+    const char* env = getenv("GRAMCSV_THREADS");
+    if (n <= 0 && env && atol(env) > 0)
+        n = atol(env);
+    if (n <= 0)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+    if (n > MAX_THREADS)
+        n = MAX_THREADS;
+    size_t by_size = data_len / MIN_CHUNK_SZ;
+    if ((size_t)n > by_size)
+        n = by_size ? by_size : 1;
+    return n;
+}
+
+/// splits `begin..end` into at most `n` ranges that start at record boundaries.
+/// The quote parity of everything before a split point tells whether it lies
+/// inside of a quoted field, so newlines inside of quotes are never picked.
+/// Returns the number of non empty ranges.
+static size_t split_segments(csv_segment_t* segs, size_t n, const char* begin, const char* end)
+{
+    size_t len = end - begin;
+    for (size_t i = 0; i < n; i++) {
+        segs[i].begin = begin + len * i / n;
+        segs[i].end = begin + len * (i + 1) / n;
+    }
+    if (n == 1)
+        return 1;
+    run_segments(segs, n, count_quotes_worker);
 
+    size_t quotes = segs[0].quotes;
+    size_t count = 1;
+    for (size_t i = 1; i < n; i++) {
+        const char* b = next_record(segs[i].begin, end, quotes & 1);
+        quotes += segs[i].quotes;
+        if (b > segs[count - 1].begin && b < end) {
+            segs[count - 1].end = b;
+            segs[count].begin = b;
+            count++;
+        }
+    }
+    segs[count - 1].end = end;
+    return count;
+}
+
+/// bytes a single allocation needs for the file name, the headers and the column pointers of `ret`
+static size_t file_names_size(const CSVFile* ret)
+{
+    size_t sz = csv_arena_need(strlen(ret->file_name) + 1, 1);
+    sz += csv_arena_need(ret->header_count * sizeof(char*), sizeof(char*));
+    for (size_t h = 0; h < ret->header_count; h++) {
+        sz += csv_arena_need(strlen(ret->headers[h]) + 1, 1);
+    }
+    return sz + csv_arena_need(ret->col_count * sizeof(double*), sizeof(double*));
+}
+
+/// moves the file name and the headers of `ret` into `arena` and allocates the column pointers there
+static void file_move_names(csv_arena_t* arena, CSVFile* ret)
+{
+    char* file_name = csv_arena_strdup(arena, ret->file_name);
+    free(ret->file_name);
+    ret->file_name = file_name;
+    char** headers = csv_arena_alloc(arena, ret->header_count * sizeof(char*), sizeof(char*));
+    for (size_t h = 0; h < ret->header_count; h++) {
+        headers[h] = csv_arena_strdup(arena, ret->headers[h]);
+        free(ret->headers[h]);
+    }
+    free(ret->headers);
     ret->headers = headers;
-    ret->header_count = fields_per_record;
+    ret->columns = csv_arena_alloc(arena, ret->col_count * sizeof(double*), sizeof(double*));
+}
 
-    ret->col_count = fields_per_record;
-    ret->columns = calloc(ret->col_count, sizeof(double*));
-    // columns
-    size_t cbuf_sz = 16;
-    size_t cbuf_p = 0;
+/// moves the typed segment columns into `ret`, freeing the segments
+static void stitch_typed(CSVFile* ret, csv_segment_t* segs, size_t n)
+{
+    ret->col_len = 0;
+    for (size_t s = 0; s < n; s++) {
+        ret->col_len += segs[s].rows;
+    }
+    GramCsvColumn* merged = calloc(ret->col_count, sizeof(GramCsvColumn));
+    csv_column_t* parts = calloc(n, sizeof(csv_column_t));
     for (size_t i = 0; i < ret->col_count; i++) {
-        ret->columns[i] = (double*)calloc(cbuf_sz, sizeof(double));
+        for (size_t s = 0; s < n; s++) {
+            parts[s] = segs[s].typed[i];
+            segs[s].typed[i] = (csv_column_t) { 0 };
+        }
+        csv_column_merge(&merged[i], parts, n);
+    }
+    free(parts);
+    for (size_t s = 0; s < n; s++) {
+        segment_free(&segs[s]);
     }
 
-    while (!IS_EOF) {
-        size_t fields = 0;
-        line_t line = NULL;
-        while (!line && !IS_EOF) {
-            line = read_line(csv, &fields);
-            if(__errbuf[0] != '\0'){
-                gram_csv_csv_file_free(*ret);
-                return GRAMCSV_ERR_READ_LINE;
-            }
+    // widening needs the columns separately, the file gets them in one allocation afterwards
+    size_t rows = ret->col_len ? ret->col_len : 1;
+    size_t sz = file_names_size(ret) + csv_arena_need(ret->col_count * sizeof(GramCsvColumn), sizeof(void*));
+    for (size_t i = 0; i < ret->col_count; i++) {
+        sz += csv_arena_need(rows * csv_type_size(merged[i].type), 64);
+        sz += csv_arena_need(merged[i].dict_len * sizeof(char*), sizeof(char*));
+        for (size_t d = 0; d < merged[i].dict_len; d++) {
+            sz += csv_arena_need(strlen(merged[i].dict[d]) + 1, 1);
         }
-        if (line) {
-            if (fields != fields_per_record) {
-                SET_ERR("Mismatch between the number (%ld) of fields in line (%ld) and the number of headers (%ld)\n",
-                        line_count, fields,fields_per_record);
-                gram_csv_csv_file_free(*ret);
-                return GRAMCSV_ERR_IRREGULAR_FIELD_NUMBER;
-            }
-            for (size_t i = 0; i < fields; i++) {
-                char* field = line[i];
-                double v = 0.0;
-                if (field[0] != '\0') {
-                    v = atof(field);
-                }
-                if (cbuf_p + 1 >= cbuf_sz) {
-                    cbuf_sz *= 2;
-                    ret->columns[i] = realloc(ret->columns[i], cbuf_sz * sizeof(double));
-                }
-                ret->columns[i][cbuf_p] = v;
-                if (i == fields - 1)
-                    cbuf_p++;
+    }
+    csv_arena_t arena;
+    csv_arena_init(&arena, sz);
+    file_move_names(&arena, ret);
+    ret->typed = csv_arena_alloc(&arena, ret->col_count * sizeof(GramCsvColumn), sizeof(void*));
+    for (size_t i = 0; i < ret->col_count; i++) {
+        GramCsvColumn* col = &ret->typed[i];
+        *col = (GramCsvColumn) { .type = merged[i].type, .dict_len = merged[i].dict_len };
+        col->data = csv_arena_alloc(&arena, rows * csv_type_size(col->type), 64);
+        memcpy(col->data, merged[i].data, ret->col_len * csv_type_size(col->type));
+        col->dict = col->dict_len ? csv_arena_alloc(&arena, col->dict_len * sizeof(char*), sizeof(char*)) : NULL;
+        for (size_t d = 0; d < col->dict_len; d++) {
+            col->dict[d] = csv_arena_strdup(&arena, merged[i].dict[d]);
+            free(merged[i].dict[d]);
+        }
+        ret->columns[i] = col->type == GRAMCSV_TYPE_DOUBLE ? col->data : NULL;
+        free(merged[i].dict);
+        free(merged[i].data);
+    }
+    free(merged);
+    ret->mem = csv_arena_release(&arena);
+}
+
+/// moves the segment columns into `ret` (a single allocation), freeing the segments
+static void stitch_segments(CSVFile* ret, csv_segment_t* segs, size_t n)
+{
+    if (segs[0].types) {
+        stitch_typed(ret, segs, n);
+        return;
+    }
+    size_t rows = 0;
+    for (size_t s = 0; s < n; s++) {
+        rows += segs[s].rows;
+    }
+    size_t col_sz = (rows ? rows : 1) * sizeof(double);
+    csv_arena_t arena;
+    csv_arena_init(&arena, file_names_size(ret) + ret->col_count * csv_arena_need(col_sz, 64));
+    file_move_names(&arena, ret);
+    ret->col_len = rows;
+    for (size_t i = 0; i < ret->col_count; i++) {
+        ret->columns[i] = csv_arena_alloc(&arena, col_sz, 64);
+        size_t at = 0;
+        for (size_t s = 0; s < n; s++) {
+            for (csv_chunk_t* chunk = segs[s].chunks; chunk; chunk = chunk->next) {
+                memcpy(ret->columns[i] + at, chunk->columns[i], chunk->rows * sizeof(double));
+                at += chunk->rows;
             }
-            line_free(line, fields);
         }
     }
-    fclose(csv);
-    ret->col_len = cbuf_p;
+    for (size_t s = 0; s < n; s++) {
+        segment_free(&segs[s]);
+    }
+    ret->mem = csv_arena_release(&arena);
+}
+
+/// maps the whole of the open file `fd` for reading, returns 0 if no error
+static int map_fd(GramCsvParser* parser, int fd, char** map, size_t* map_len)
+{
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size == 0) {
+        SET_ERR(parser->err, "File was empty");
+        return GRAMCSV_ERR_FILE_EMPTY;
+    }
+    *map_len = st.st_size;
+    *map = mmap(NULL, *map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (*map == MAP_FAILED) {
+        SET_ERR(parser->err, "Could not open file for reading");
+        return GRAMCSV_ERR_COULD_NOT_OPEN_FILE;
+    }
+    madvise(*map, *map_len, MADV_SEQUENTIAL);
     return 0;
 }
 
+/// maps the whole file for reading, returns 0 if no error
+static int map_csv(GramCsvParser* parser, const char* csv_file, char** map, size_t* map_len)
+{
+    int fd = open(csv_file, O_RDONLY);
+    if (fd < 0) {
+        SET_ERR(parser->err, "Could not open file for reading");
+        return GRAMCSV_ERR_COULD_NOT_OPEN_FILE;
+    }
+    int err = map_fd(parser, fd, map, map_len);
+    close(fd);
+    return err;
+}
 
-static char* sanitize_guard(const char* str)
+/// marks the headers named in `parser->select`, returns 0 if no error
+static int select_columns(GramCsvParser* parser, const csv_reader_t* r, unsigned char* keep)
 {
-    if (!str)
-        return NULL;
-    size_t len = strlen(str);
-    if (len == 0) {
-        return NULL;
+    for (size_t s = 0; s < parser->select_count; s++) {
+        const char* name = parser->select[s];
+        size_t i = 0;
+        for (; i < r->fields_p; i++) {
+            char* header = span_strdup(r->fields[i]);
+            int found = strcmp(header, name) == 0;
+            free(header);
+            if (found)
+                break;
+        }
+        if (i == r->fields_p) {
+            SET_ERR(parser->err, "No column named `%s`", name);
+            return GRAMCSV_ERR_NO_SUCH_COLUMN;
+        }
+        keep[i] = 1;
     }
-    char* n_next = calloc(len + 1, sizeof(char));
-    size_t i = 0;
-    while (i < len) {
-        char c = str[i];
-        if (c == '.')
+    return 0;
+}
+
+/// skips empty lines up to the first record and copies out the fields selected by the parser,
+/// after which `r` only tokenizes the selected fields. `*keep` is set to the selection
+/// (NULL when every column is loaded) and has to be freed by the caller. Returns 0 if no error
+static int read_headers(GramCsvParser* parser, csv_reader_t* r, char*** headers, size_t* header_count,
+    unsigned char** keep)
+{
+    *keep = NULL;
+    while (1) {
+        if (read_line(r, header_count)) {
+            return GRAMCSV_ERR_READ_LINE;
+        }
+        if (*header_count)
             break;
-        if (!isalnum(c)) {
-            n_next[i] = '_';
-        } else {
-            n_next[i] = toupper(str[i]);
+        if (r->eof) {
+            SET_ERR(parser->err, "File was empty");
+            return GRAMCSV_ERR_FILE_EMPTY;
         }
-        i++;
     }
-    if (i == 0)
-        return NULL;
-    return n_next;
+    r->header_count = *header_count;
+    if (parser->select && parser->select_count) {
+        *keep = calloc(*header_count, sizeof(unsigned char));
+        if (select_columns(parser, r, *keep)) {
+            free(*keep);
+            *keep = NULL;
+            return GRAMCSV_ERR_NO_SUCH_COLUMN;
+        }
+        r->keep = *keep;
+    }
+    *headers = calloc(*header_count, sizeof(char*));
+    size_t n = 0;
+    for (size_t i = 0; i < r->header_count; i++) {
+        if (!r->keep || r->keep[i])
+            (*headers)[n++] = span_strdup(r->fields[i]);
+    }
+    *header_count = n;
+    return 0;
 }
-static char* sanitize_header(const char* str)
+
+static void headers_free(char** headers, size_t header_count)
 {
-    if (!str)
-        return NULL;
-    size_t len = strlen(str);
-    if (len == 0) {
+    for (size_t i = 0; i < header_count; i++) {
+        free(headers[i]);
+    }
+    free(headers);
+}
+
+/// picks the storage of every loaded column from the hints of the parser and,
+/// with type inference, from the first records after `r->cur`. Returns NULL if
+/// every column is stored as plain doubles
+static csv_type_t* pick_types(GramCsvParser* parser, const csv_reader_t* r, char** headers, size_t header_count)
+{
+    if (!parser->infer_types && !parser->hint_count)
         return NULL;
+    csv_type_t* types = calloc(header_count ? header_count : 1, sizeof(csv_type_t));
+    for (size_t i = 0; i < header_count; i++) {
+        types[i] = (csv_type_t) { .type = GRAMCSV_TYPE_DOUBLE, .fixed = !parser->infer_types };
+        for (size_t h = 0; h < parser->hint_count; h++) {
+            if (strcmp(parser->hints[h].name, headers[i]) == 0)
+                types[i] = (csv_type_t) { .type = parser->hints[h].type, .fixed = 1 };
+        }
     }
-    char* head = calloc(len + 1, sizeof(char));
-    size_t i = 0;
-    while (i < len) {
-        char c = str[i];
-        if (!isalnum(c) || isspace(c)) {
-            head[i] = '_';
-        } else {
-            head[i] = tolower(str[i]);
+    if (!parser->infer_types)
+        return types;
+
+    // a column holding anything but numbers in the sample is text, a sampling error
+    // is left for the real parse to report
+    char errbuf[ERRBUF_SZ];
+    csv_reader_t sample;
+    reader_init(&sample, r->cur, r->end, errbuf);
+    sample.eof = r->eof;
+    sample.header_count = r->header_count;
+    sample.keep = r->keep;
+    for (size_t row = 0; row < SAMPLE_ROWS; row++) {
+        size_t fields = 0;
+        if (read_record(&sample, &fields) || !fields)
+            break;
+        for (size_t i = 0; i < header_count; i++) {
+            span_t field = sample.fields[i];
+            if (!types[i].fixed && field.len && (field.escaped || !csv_is_number(field.ptr, field.len)))
+                types[i] = (csv_type_t) { .type = GRAMCSV_TYPE_DICT, .fixed = 1 };
         }
-        i++;
     }
-    if (i == 0)
-        return NULL;
-    return head;
-}
-
-void gram_csv_write_header_file(CSVFile* csv, const char* header_file)
-{
-    FILE* f = fopen(header_file, "w");
-    char* guard = sanitize_guard(csv->file_name);
-    guard = guard ? guard : "UNNAMED";
-    fprintf(f, "#ifndef _%s_DATASET_H\n"
-               "#define _%s_DATASET_H\n",
-        guard, guard);
-
-    // define the struct
-    fprintf(f, "struct _gram_dataset_%s {\n", guard);
-    fprintf(f, "\t unsigned long column_count;\n");
-    fprintf(f, "\t unsigned long data_count;\n");
-
-    for (size_t h = 0; h < csv->header_count; h++) {
-        char* header = sanitize_header(csv->headers[h]);
-        fprintf(f, "\t double h%s[%ld];\n", header, csv->col_len);
-        free(header);
-    }
-    fprintf(f, "} D%s = {\n", guard);
-
-    fprintf(f, "\t .column_count = %ld,\n", csv->col_count);
-    fprintf(f, "\t .data_count = %ld,\n", csv->col_len);
-    // initialize columns
-    for (size_t h = 0; h < csv->header_count; h++) {
-        char* header = sanitize_header(csv->headers[h]);
-        fprintf(f, "\t .h%s = {\n\t\t", header);
-        free(header);
-        for (size_t i = 0; i < csv->col_len; i++) {
-            fprintf(f, "%lf", csv->columns[h][i]);
-            if (i != csv->col_len - 1) {
-                fprintf(f, ", ");
+    reader_free(&sample);
+    return types;
+}
+
+/// decompressed input, handed to the tokenizer a window of whole records at a time
+typedef struct {
+    csv_inflate_t* z;
+    /// `buf[0..len)` holds the bytes that were not parsed yet, `buf..end` the whole records among them
+    char* buf;
+    size_t len;
+    size_t cap;
+    char* end;
+    /// `buf[0..scanned)` was looked at for record ends, `in_quote` is set if it ends inside a
+    /// quoted field. Every block is scanned once, however many of them a record spans
+    size_t scanned;
+    int in_quote;
+    /// bytes parsed before `buf`
+    size_t offset;
+    size_t line_count;
+    /// the window holds the rest of the input
+    int last;
+    /// fields per record and the kept ones, set once the headers are read
+    int headers;
+    size_t field_count;
+    unsigned char* keep;
+} csv_window_t;
+
+static void window_free(csv_window_t* w)
+{
+    if (w->z)
+        csv_inflate_finish(w->z);
+    free(w->buf);
+    free(w->keep);
+}
+
+/// whether the window holds the headers and the records type inference samples,
+/// a broken record ends the count (the parse reports it)
+static int window_has_sample(csv_window_t* w)
+{
+    char errbuf[ERRBUF_SZ];
+    csv_reader_t r;
+    reader_init(&r, w->buf, w->end, errbuf);
+    r.eof = w->buf == w->end;
+    size_t records = 0;
+    while (!r.eof && records <= SAMPLE_ROWS) {
+        size_t fields = 0;
+        if (read_line(&r, &fields))
+            break;
+        records += fields != 0;
+    }
+    reader_free(&r);
+    return records > SAMPLE_ROWS;
+}
+
+/// moves past the records parsed from the current window and waits for enough input to make up the
+/// next one. `*ready` is cleared at the end of the input. Returns 0 if no error
+static int window_next(GramCsvParser* parser, csv_window_t* w, int* ready)
+{
+    *ready = 0;
+    if (w->last)
+        return 0;
+    // a record cut off by the end of a block is carried over to the front
+    size_t rest = w->len - (w->end - w->buf);
+    w->offset += w->end - w->buf;
+    if (rest)
+        memmove(w->buf, w->end, rest);
+    w->len = rest;
+    w->end = w->buf;
+    // no record ends in what is carried over, the parity at its end stays the same
+    w->scanned = rest;
+    // the first window takes as much as type inference looks at, as a mapped file would offer it
+    while (w->end == w->buf || (!w->headers && !window_has_sample(w))) {
+        const char* block = NULL;
+        size_t n = csv_inflate_next(w->z, &block);
+        if (!n) {
+            int err = csv_inflate_finish(w->z);
+            w->z = NULL;
+            if (err) {
+                SET_ERR(parser->err, "Compressed data is corrupt or truncated");
+                return GRAMCSV_ERR_COMPRESSION;
             }
+            w->last = 1;
+            w->end = w->buf + w->len;
+            break;
+        }
+        if (w->len + n > w->cap) {
+            // grown by doubling, a record can span any number of blocks
+            size_t whole = w->end - w->buf;
+            w->cap = w->len + n > w->cap * 2 ? w->len + n : w->cap * 2;
+            w->buf = realloc(w->buf, w->cap);
+            w->end = w->buf + whole;
         }
-        fprintf(f, "\n\t},\n");
+        memcpy(w->buf + w->len, block, n);
+        w->len += n;
+        const char* end = last_record_end(w->buf + w->scanned, w->buf + w->len, &w->in_quote);
+        w->scanned = w->len;
+        if (end)
+            w->end = (char*)end;
     }
-    fprintf(f, "\n};\n");
+    *ready = 1;
+    return 0;
+}
 
-    free(guard);
-    fprintf(f, "#endif\n");
-    fclose(f);
+/// sets `r` up over the records of the current window. The headers are read from the first window
+/// that has any, until then `*headers` is left NULL. Returns 0 if no error
+static int window_reader(GramCsvParser* parser, csv_window_t* w, csv_reader_t* r, char*** headers,
+    size_t* header_count)
+{
+    reader_init(r, w->buf, w->end, parser->err);
+    r->eof = w->buf == w->end;
+    r->offset = w->offset;
+    r->line_count = w->line_count;
+    r->header_count = w->field_count;
+    r->keep = w->keep;
+    if (w->headers)
+        return 0;
+    int err = read_headers(parser, r, headers, header_count, &w->keep);
+    if (err == GRAMCSV_ERR_FILE_EMPTY && !w->last) {
+        // nothing but empty lines so far
+        parser->err[0] = '\0';
+        *headers = NULL;
+        return 0;
+    }
+    if (err)
+        return err;
+    w->headers = 1;
+    w->field_count = r->header_count;
+    return 0;
+}
+
+/// opens the decoder of the mapped compressed file, returns 0 if no error
+static int window_init(GramCsvParser* parser, csv_window_t* w, const char* map, size_t map_len,
+    csv_compression_t kind)
+{
+    *w = (csv_window_t) { 0 };
+    if (!csv_inflate_supported(kind)) {
+        SET_ERR(parser->err, "File is %s compressed, which this build cannot read", csv_compression_name(kind));
+        return GRAMCSV_ERR_COMPRESSION;
+    }
+    w->z = csv_inflate_start(map, map_len, kind);
+    if (!w->z) {
+        SET_ERR(parser->err, "Could not start decompressing the file");
+        return GRAMCSV_ERR_COMPRESSION;
+    }
+    return 0;
+}
+
+/// `gram_csv_parser_stream` for a compressed file, decompressed on another thread as it is parsed
+static int stream_compressed(GramCsvParser* parser, const char* map, size_t map_len, csv_compression_t kind,
+    size_t batch_rows, gram_csv_batch_fn fn, void* user)
+{
+    csv_window_t w;
+    int err = window_init(parser, &w, map, map_len, kind);
+    if (err)
+        return err;
+    // the size of the decompressed file is not known up front
+    GramCsvBatch batch = { 0 };
+    batch_rows = batch_rows ? batch_rows : BATCH_ROWS;
+    int ready = 0;
+    int stopped = 0;
+    while (!stopped && !(err = window_next(parser, &w, &ready)) && ready) {
+        csv_reader_t r;
+        char** headers = NULL;
+        err = window_reader(parser, &w, &r, &headers, &batch.header_count);
+        if (!err && headers) {
+            batch.headers = headers;
+            batch.columns = columns_alloc(batch.header_count, batch_rows);
+        }
+        if (!err && w.headers)
+            err = stream_records(&r, &batch, batch_rows, fn, user, !w.last, &stopped);
+        w.line_count = r.line_count;
+        reader_free(&r);
+        if (err)
+            break;
+    }
+    if (batch.headers) {
+        columns_free(batch.columns, batch.header_count);
+        headers_free(batch.headers, batch.header_count);
+    }
+    window_free(&w);
+    return err;
+}
+
+int gram_csv_parser_stream(GramCsvParser* parser, const char* csv_file, size_t batch_rows,
+    gram_csv_batch_fn fn, void* user)
+{
+    parser->err[0] = '\0';
+    char* map = NULL;
+    size_t map_len = 0;
+    int err = map_csv(parser, csv_file, &map, &map_len);
+    if (err)
+        return err;
+
+    csv_compression_t kind = csv_compression(map, map_len);
+    if (kind != CSV_PLAIN) {
+        err = stream_compressed(parser, map, map_len, kind, batch_rows, fn, user);
+        munmap(map, map_len);
+        return err;
+    }
+
+    csv_reader_t r;
+    reader_init(&r, map, map + map_len, parser->err);
+    r.release = 1;
+    r.released = map;
+    GramCsvBatch batch = { .file_size = map_len };
+    unsigned char* keep = NULL;
+    err = read_headers(parser, &r, &batch.headers, &batch.header_count, &keep);
+    if (!err) {
+        batch_rows = batch_rows ? batch_rows : BATCH_ROWS;
+        batch.columns = columns_alloc(batch.header_count, batch_rows);
+        int stopped = 0;
+        err = stream_records(&r, &batch, batch_rows, fn, user, 0, &stopped);
+        columns_free(batch.columns, batch.header_count);
+        headers_free(batch.headers, batch.header_count);
+    }
+    free(keep);
+    reader_free(&r);
+    munmap(map, map_len);
+    return err;
+}
+
+/// where a load of whole records left off, for a follow to carry on from there
+typedef struct {
+    /// fields per record of the file and the ones that were kept (NULL for all)
+    size_t field_count;
+    unsigned char* keep;
+    /// records read including the headers and empty lines
+    size_t line_count;
+} csv_tail_t;
+
+/// parses the records of `begin..end` into `ret`, when `tail` is given it receives
+/// the selection (which the caller frees then) and the line count. Returns 0 if no error
+static int load_range(GramCsvParser* parser, const char* csv_file, const char* begin, const char* end, CSVFile* ret,
+    csv_tail_t* tail)
+{
+    *ret = (CSVFile) { 0 };
+    csv_reader_t r;
+    reader_init(&r, begin, end, parser->err);
+    r.eof = begin == end;
+    unsigned char* keep = NULL;
+    int err = read_headers(parser, &r, &ret->headers, &ret->header_count, &keep);
+    if (err) {
+        reader_free(&r);
+        return err;
+    }
+    ret->file_name = get_file_name(csv_file);
+    ret->col_count = ret->header_count;
+    csv_type_t* types = pick_types(parser, &r, ret->headers, ret->header_count);
+
+    csv_segment_t segs[MAX_THREADS] = { 0 };
+    size_t n = thread_count(parser, r.end - r.cur);
+    n = split_segments(segs, n, r.cur, r.end);
+    for (size_t i = 0; i < n; i++) {
+        segs[i].header_count = r.header_count;
+        segs[i].keep = keep;
+        segs[i].types = types;
+        segs[i].col_count = ret->col_count;
+        csv_arena_init(&segs[i].arena, ARENA_BLOCK_SZ);
+    }
+    segs[0].line_offset = r.line_count;
+    size_t field_count = r.header_count;
+    reader_free(&r);
+    run_segments(segs, n, parse_segment_worker);
+
+    // the first failed segment is parsed again to the end of the file with the right line numbers,
+    // which yields exactly the error (or result) of a serial parse
+    for (size_t i = 0; i < n; i++) {
+        if (!segs[i].err) {
+            if (i + 1 < n)
+                segs[i + 1].line_offset = segs[i].line_offset + segs[i].lines;
+            continue;
+        }
+        for (size_t k = i + 1; k < n; k++) {
+            segment_free(&segs[k]);
+        }
+        segs[i].end = end;
+        err = parse_segment(&segs[i]);
+        if (err)
+            memcpy(parser->err, segs[i].errbuf, ERRBUF_SZ);
+        n = i + 1;
+        break;
+    }
+    if (err) {
+        free(keep);
+        for (size_t i = 0; i < n; i++) {
+            segment_free(&segs[i]);
+        }
+        free(types);
+        gram_csv_csv_file_free(*ret);
+        *ret = (CSVFile) { 0 };
+        return err;
+    }
+    if (tail) {
+        *tail = (csv_tail_t) {
+            .field_count = field_count,
+            .keep = keep,
+            .line_count = segs[n - 1].line_offset + segs[n - 1].lines,
+        };
+    } else {
+        free(keep);
+    }
+    stitch_segments(ret, segs, n);
+    free(types);
+    return 0;
+}
+
+/// `gram_csv_parser_load` for a compressed file, the records of each window are parsed
+/// while the decoder fills the next one
+static int load_compressed(GramCsvParser* parser, const char* csv_file, const char* map, size_t map_len,
+    csv_compression_t kind, CSVFile* ret)
+{
+    csv_window_t w;
+    int err = window_init(parser, &w, map, map_len, kind);
+    if (err)
+        return err;
+    csv_segment_t seg = { 0 };
+    csv_arena_init(&seg.arena, ARENA_BLOCK_SZ);
+    GramCsvBatch batch = { 0 };
+    csv_type_t* types = NULL;
+    int ready = 0;
+    int stopped = 0;
+    while (!(err = window_next(parser, &w, &ready)) && ready) {
+        csv_reader_t r;
+        char** headers = NULL;
+        err = window_reader(parser, &w, &r, &headers, &ret->header_count);
+        if (!err && headers) {
+            ret->headers = headers;
+            ret->file_name = get_file_name(csv_file);
+            ret->col_count = ret->header_count;
+            types = pick_types(parser, &r, ret->headers, ret->header_count);
+            seg.col_count = ret->col_count;
+            seg.types = types;
+            if (types) {
+                segment_init_typed(&seg);
+            } else {
+                batch.header_count = seg.col_count;
+                seg.batch = &batch;
+                batch.columns = chunk_new(&seg)->columns;
+            }
+        }
+        if (!err && w.headers) {
+            err = types ? collect_typed(&seg, &r)
+                        : stream_records(&r, &batch, BATCH_ROWS, segment_collect, &seg, !w.last, &stopped);
+        }
+        w.line_count = r.line_count;
+        reader_free(&r);
+        if (err)
+            break;
+    }
+    seg.batch = NULL;
+    window_free(&w);
+    if (err) {
+        segment_free(&seg);
+        free(types);
+        gram_csv_csv_file_free(*ret);
+        *ret = (CSVFile) { 0 };
+        return err;
+    }
+    stitch_segments(ret, &seg, 1);
+    free(types);
+    return 0;
+}
+
+int gram_csv_parser_load(GramCsvParser* parser, const char* csv_file, CSVFile* ret)
+{
+    *ret = (CSVFile) { 0 };
+    parser->err[0] = '\0';
+    char* map = NULL;
+    size_t map_len = 0;
+    int err = map_csv(parser, csv_file, &map, &map_len);
+    if (err)
+        return err;
+    csv_compression_t kind = csv_compression(map, map_len);
+    if (kind != CSV_PLAIN) {
+        err = load_compressed(parser, csv_file, map, map_len, kind, ret);
+    } else {
+        err = load_range(parser, csv_file, map, map + map_len, ret, NULL);
+    }
+    munmap(map, map_len);
+    return err;
+}
+
+/// makes room for at least one more row in every column of the follow
+static void follow_grow(GramCsvFollow* follow)
+{
+    follow->cap = follow->cap ? follow->cap * 2 : FOLLOW_MIN_ROWS;
+    for (size_t i = 0; i < follow->csv.col_count; i++) {
+        follow->csv.columns[i] = realloc(follow->csv.columns[i], follow->cap * sizeof(double));
+    }
+}
+
+int gram_csv_parser_follow(GramCsvParser* parser, const char* csv_file, GramCsvFollow* follow)
+{
+    *follow = (GramCsvFollow) { .fd = -1 };
+    parser->err[0] = '\0';
+    int fd = open(csv_file, O_RDONLY);
+    if (fd < 0) {
+        SET_ERR(parser->err, "Could not open file for reading");
+        return GRAMCSV_ERR_COULD_NOT_OPEN_FILE;
+    }
+    char* map = NULL;
+    size_t map_len = 0;
+    int err = map_fd(parser, fd, &map, &map_len);
+    if (err) {
+        close(fd);
+        return err;
+    }
+    if (csv_compression(map, map_len) != CSV_PLAIN) {
+        SET_ERR(parser->err, "Compressed files cannot be followed");
+        munmap(map, map_len);
+        close(fd);
+        return GRAMCSV_ERR_COMPRESSION;
+    }
+    // appended rows are converted one by one, so the columns stay doubles like those of a batch
+    GramCsvParser plain = *parser;
+    plain.infer_types = 0;
+    plain.hint_count = 0;
+    const char* end = complete_end(map, map + map_len);
+    CSVFile loaded;
+    csv_tail_t tail;
+    err = load_range(&plain, csv_file, map, end, &loaded, &tail);
+    munmap(map, map_len);
+    if (err) {
+        memcpy(parser->err, plain.err, ERRBUF_SZ);
+        close(fd);
+        return err;
+    }
+
+    // the loaded file is a single block, the follow needs columns it can grow one by one
+    CSVFile* csv = &follow->csv;
+    csv->file_name = strdup(loaded.file_name);
+    csv->header_count = loaded.header_count;
+    csv->headers = calloc(loaded.header_count ? loaded.header_count : 1, sizeof(char*));
+    for (size_t h = 0; h < loaded.header_count; h++) {
+        csv->headers[h] = strdup(loaded.headers[h]);
+    }
+    csv->col_count = loaded.col_count;
+    csv->col_len = loaded.col_len;
+    csv->columns = calloc(loaded.col_count ? loaded.col_count : 1, sizeof(double*));
+    follow->cap = loaded.col_len;
+    follow_grow(follow);
+    for (size_t i = 0; i < loaded.col_count; i++) {
+        memcpy(csv->columns[i], loaded.columns[i], loaded.col_len * sizeof(double));
+    }
+    gram_csv_csv_file_free(loaded);
+
+    follow->fd = fd;
+    follow->offset = end - map;
+    follow->field_count = tail.field_count;
+    follow->keep = tail.keep;
+    follow->line_count = tail.line_count;
+    return 0;
+}
+
+int gram_csv_follow_poll(GramCsvParser* parser, GramCsvFollow* follow, size_t* rows)
+{
+    *rows = 0;
+    parser->err[0] = '\0';
+    struct stat st;
+    if (fstat(follow->fd, &st)) {
+        SET_ERR(parser->err, "Could not open file for reading");
+        return GRAMCSV_ERR_COULD_NOT_OPEN_FILE;
+    }
+    size_t size = st.st_size;
+    if (size < follow->offset) {
+        SET_ERR(parser->err, "File got shorter while being followed");
+        return GRAMCSV_ERR_TRUNCATED;
+    }
+    if (size == follow->offset)
+        return 0;
+
+    size_t len = size - follow->offset;
+    if (len > follow->buf_sz) {
+        follow->buf = realloc(follow->buf, len);
+        follow->buf_sz = len;
+    }
+    ssize_t got = pread(follow->fd, follow->buf, len, follow->offset);
+    if (got < 0) {
+        SET_ERR(parser->err, "Could not open file for reading");
+        return GRAMCSV_ERR_COULD_NOT_OPEN_FILE;
+    }
+    // a record that is still being written is read again by a later poll
+    const char* end = complete_end(follow->buf, follow->buf + got);
+    if (end == follow->buf)
+        return 0;
+
+    csv_reader_t r;
+    reader_init(&r, follow->buf, end, parser->err);
+    r.line_count = follow->line_count;
+    r.header_count = follow->field_count;
+    r.keep = follow->keep;
+    CSVFile* csv = &follow->csv;
+    size_t first = csv->col_len;
+    int err = 0;
+    while (1) {
+        size_t fields = 0;
+        err = read_record(&r, &fields);
+        if (err || !fields)
+            break;
+        if (csv->col_len == follow->cap)
+            follow_grow(follow);
+        for (size_t i = 0; i < csv->col_count; i++) {
+            span_t field = r.fields[i];
+            csv->columns[i][csv->col_len] = field.len ? span_to_double(&r, field) : 0.0;
+        }
+        csv->col_len++;
+    }
+    if (err) {
+        // nothing of a broken append is kept, the same error comes up again on the next poll
+        csv->col_len = first;
+    } else {
+        follow->offset += end - follow->buf;
+        follow->line_count = r.line_count;
+        *rows = csv->col_len - first;
+    }
+    reader_free(&r);
+    return err;
+}
+
+void gram_csv_follow_free(GramCsvFollow* follow)
+{
+    if (follow->fd >= 0)
+        close(follow->fd);
+    free(follow->keep);
+    free(follow->buf);
+    gram_csv_csv_file_free(follow->csv);
+    *follow = (GramCsvFollow) { .fd = -1 };
+}
+
+int gram_csv_load_csv(const char* csv_file, CSVFile* ret)
+{
+    return gram_csv_parser_load(&default_parser, csv_file, ret);
 }
@@ -0,0 +1,151 @@
+#include "gram_csv_scan.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && !defined(GRAMCSV_NO_SIMD)
+#define GRAMCSV_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*classify_fn)(const char*, uint64_t*, uint64_t*);
+
+/// sets bit `i` of `quotes` for every `"` and bit `i` of `delims` for every `,` `\r` `\n` in `p[0..64)`
+static void classify_scalar(const char* p, uint64_t* quotes, uint64_t* delims)
+{
+    uint64_t q = 0, d = 0;
+    for (int i = 0; i < GRAMCSV_SCAN_BLOCK; i++) {
+        char c = p[i];
+        q |= (uint64_t)(c == '"') << i;
+        d |= (uint64_t)(c == ',' || c == '\r' || c == '\n') << i;
+    }
+    *quotes = q;
+    *delims = d;
+}
+
+#ifdef GRAMCSV_X86
+static void classify_sse2(const char* p, uint64_t* quotes, uint64_t* delims)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    uint64_t q = 0, d = 0;
+    for (int i = 0; i < GRAMCSV_SCAN_BLOCK; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i del = _mm_or_si128(_mm_cmpeq_epi8(v, comma),
+            _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+        q |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << i;
+        d |= (uint64_t)(uint16_t)_mm_movemask_epi8(del) << i;
+    }
+    *quotes = q;
+    *delims = d;
+}
+
+__attribute__((target("avx2"))) static void classify_avx2(const char* p, uint64_t* quotes, uint64_t* delims)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    uint64_t q = 0, d = 0;
+    for (int i = 0; i < GRAMCSV_SCAN_BLOCK; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i del = _mm256_or_si256(_mm256_cmpeq_epi8(v, comma),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+        q |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)) << i;
+        d |= (uint64_t)(uint32_t)_mm256_movemask_epi8(del) << i;
+    }
+    *quotes = q;
+    *delims = d;
+}
+#endif
+
+static classify_fn classify = NULL;
+static const char* classify_name = NULL;
+static pthread_once_t classify_once = PTHREAD_ONCE_INIT;
+
+static void select_impl(void)
+{
+    const char* force = getenv("GRAMCSV_SCAN");
+    if (force && strcmp(force, "scalar") == 0) {
+        classify_name = "scalar";
+        classify = classify_scalar;
+        return;
+    }
+#ifdef GRAMCSV_X86
+    if (__builtin_cpu_supports("avx2")) {
+        classify_name = "avx2";
+        classify = classify_avx2;
+    } else {
+        classify_name = "sse2";
+        classify = classify_sse2;
+    }
+#else
+    classify_name = "scalar";
+    classify = classify_scalar;
+#endif
+}
+
+const char* csv_scanner_impl(void)
+{
+    pthread_once(&classify_once, select_impl);
+    return classify_name;
+}
+
+/// bit `i` of the result is the parity of bits `0..i` of `x`
+static uint64_t prefix_xor(uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+void csv_scanner_load(csv_scanner_t* s)
+{
+    uint64_t quotes, delims;
+    if (s->end - s->block >= GRAMCSV_SCAN_BLOCK) {
+        classify(s->block, &quotes, &delims);
+    } else {
+        // the last partial block is padded with bytes that are never structural
+        char pad[GRAMCSV_SCAN_BLOCK] = { 0 };
+        memcpy(pad, s->block, s->end - s->block);
+        classify(pad, &quotes, &delims);
+    }
+    // opening quotes and everything up to the matching closing quote,
+    // escaped quotes toggle twice so they do not end the region
+    uint64_t in_quote = prefix_xor(quotes) ^ s->quote_carry;
+    s->quote_carry = (uint64_t)((int64_t)in_quote >> 63);
+    s->bits = (delims & ~in_quote) | quotes;
+}
+
+void csv_scanner_init(csv_scanner_t* s, const char* begin, const char* end, int in_quote)
+{
+    pthread_once(&classify_once, select_impl);
+    s->block = begin;
+    s->end = end;
+    s->bits = 0;
+    s->quote_carry = in_quote ? ~(uint64_t)0 : 0;
+    if (begin < end)
+        csv_scanner_load(s);
+}
+
+size_t csv_count_quotes(const char* begin, const char* end)
+{
+    pthread_once(&classify_once, select_impl);
+    size_t n = 0;
+    uint64_t quotes, delims;
+    const char* p = begin;
+    for (; end - p >= GRAMCSV_SCAN_BLOCK; p += GRAMCSV_SCAN_BLOCK) {
+        classify(p, &quotes, &delims);
+        n += __builtin_popcountll(quotes);
+    }
+    for (; p < end; p++) {
+        n += *p == '"';
+    }
+    return n;
+}
@@ -0,0 +1,205 @@
+#include "gram_lua_heap.h"
+#include <lauxlib.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// size classes are multiples of this, which keeps every block aligned for any lua value
+#define HEAP_GRAIN 16
+/// blocks up to this size are pooled, tables, strings and closures mostly are
+#define HEAP_MAX_POOLED 512
+#define HEAP_CLASSES (HEAP_MAX_POOLED / HEAP_GRAIN)
+#define HEAP_CHUNK (64 * 1024)
+
+#define SENTINEL_META "gram.heap.sentinel"
+
+typedef struct heap_chunk_t {
+    struct heap_chunk_t* next;
+    /// the blocks follow, aligned to `HEAP_GRAIN`
+    _Alignas(HEAP_GRAIN) unsigned char data[];
+} heap_chunk_t;
+
+/// a block on a free list, reusing its own memory
+typedef struct heap_block_t {
+    struct heap_block_t* next;
+} heap_block_t;
+
+struct GramLuaHeap {
+    heap_block_t* free[HEAP_CLASSES];
+    heap_chunk_t* chunks;
+    /// chunk blocks are carved out of, the ones after it are left over from before a reset
+    heap_chunk_t* chunk;
+    size_t used;
+    /// pooled blocks in use
+    size_t live;
+    GramLuaHeapStats stats;
+};
+
+static size_t size_class(size_t size)
+{
+    return (size + HEAP_GRAIN - 1) / HEAP_GRAIN - 1;
+}
+
+static void* pool_alloc(GramLuaHeap* h, size_t cls)
+{
+    heap_block_t* b = h->free[cls];
+    if (b) {
+        h->free[cls] = b->next;
+        return b;
+    }
+    size_t size = (cls + 1) * HEAP_GRAIN;
+    if (!h->chunk || h->used + size > HEAP_CHUNK - sizeof(heap_chunk_t)) {
+        // a chunk kept from before a reset, a new one otherwise
+        heap_chunk_t* c = h->chunk ? h->chunk->next : h->chunks;
+        if (!c) {
+            c = malloc(HEAP_CHUNK);
+            if (!c)
+                return NULL;
+            c->next = NULL;
+            if (h->chunk) {
+                h->chunk->next = c;
+            } else {
+                h->chunks = c;
+            }
+        }
+        h->chunk = c;
+        h->used = 0;
+    }
+    void* p = &h->chunk->data[h->used];
+    h->used += size;
+    return p;
+}
+
+static void pool_release(GramLuaHeap* h, void* p, size_t cls)
+{
+    heap_block_t* b = p;
+    b->next = h->free[cls];
+    h->free[cls] = b;
+}
+
+/// a new block of `nsize` bytes, NULL if there is no memory left
+static void* heap_take(GramLuaHeap* h, size_t nsize)
+{
+    void* p;
+    if (nsize <= HEAP_MAX_POOLED) {
+        p = pool_alloc(h, size_class(nsize));
+        h->live += p != NULL;
+        h->stats.pooled += p != NULL;
+    } else {
+        p = malloc(nsize);
+    }
+    if (!p)
+        return NULL;
+    h->stats.allocs++;
+    h->stats.bytes += nsize;
+    h->stats.peak_bytes = h->stats.bytes > h->stats.peak_bytes ? h->stats.bytes : h->stats.peak_bytes;
+    return p;
+}
+
+static void heap_give(GramLuaHeap* h, void* p, size_t osize)
+{
+    if (osize <= HEAP_MAX_POOLED) {
+        pool_release(h, p, size_class(osize));
+        h->live--;
+    } else {
+        free(p);
+    }
+    h->stats.frees++;
+    h->stats.bytes -= osize;
+}
+
+void* gram_lua_heap_alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+    GramLuaHeap* h = ud;
+    // without a block `osize` tells what kind of object is made, not a size
+    if (!ptr)
+        return nsize ? heap_take(h, nsize) : NULL;
+    if (!nsize) {
+        heap_give(h, ptr, osize);
+        return NULL;
+    }
+    if (osize <= HEAP_MAX_POOLED && nsize <= HEAP_MAX_POOLED && size_class(osize) == size_class(nsize)) {
+        h->stats.bytes += nsize - osize;
+        h->stats.peak_bytes = h->stats.bytes > h->stats.peak_bytes ? h->stats.bytes : h->stats.peak_bytes;
+        return ptr;
+    }
+    if (osize > HEAP_MAX_POOLED && nsize > HEAP_MAX_POOLED) {
+        void* p = realloc(ptr, nsize);
+        if (!p)
+            return NULL;
+        h->stats.bytes += nsize - osize;
+        h->stats.peak_bytes = h->stats.bytes > h->stats.peak_bytes ? h->stats.bytes : h->stats.peak_bytes;
+        return p;
+    }
+    void* p = heap_take(h, nsize);
+    if (!p)
+        return NULL;
+    memcpy(p, ptr, osize < nsize ? osize : nsize);
+    heap_give(h, ptr, osize);
+    return p;
+}
+
+lua_State* gram_lua_heap_state(GramLuaHeap* heap)
+{
+    lua_State* l = lua_newstate(gram_lua_heap_alloc, heap);
+    return l ? l : luaL_newstate();
+}
+
+GramLuaHeap* gram_lua_heap_new(void)
+{
+    return calloc(1, sizeof(GramLuaHeap));
+}
+
+void gram_lua_heap_reset(GramLuaHeap* heap)
+{
+    if (heap->live)
+        return;
+    memset(heap->free, 0, sizeof(heap->free));
+    heap->chunk = NULL;
+    heap->used = 0;
+}
+
+static void push_sentinel(lua_State* l, GramLuaHeap* heap);
+
+/// the sentinel is garbage as soon as it is made, so every cycle finalizes one
+static int sentinel_gc(lua_State* l)
+{
+    GramLuaHeap* heap = lua_touserdata(l, lua_upvalueindex(1));
+    heap->stats.collections++;
+    push_sentinel(l, heap);
+    lua_pop(l, 1);
+    return 0;
+}
+
+static void push_sentinel(lua_State* l, GramLuaHeap* heap)
+{
+    lua_newuserdata(l, 0);
+    if (luaL_newmetatable(l, SENTINEL_META)) {
+        lua_pushlightuserdata(l, heap);
+        lua_pushcclosure(l, sentinel_gc, 1);
+        lua_setfield(l, -2, "__gc");
+    }
+    lua_setmetatable(l, -2);
+}
+
+void gram_lua_heap_watch(GramLuaHeap* heap, lua_State* l)
+{
+    push_sentinel(l, heap);
+    lua_pop(l, 1);
+}
+
+void gram_lua_heap_stats(const GramLuaHeap* heap, GramLuaHeapStats* stats)
+{
+    *stats = heap->stats;
+}
+
+void gram_lua_heap_free(GramLuaHeap* heap)
+{
+    if (!heap)
+        return;
+    for (heap_chunk_t* c = heap->chunks; c;) {
+        heap_chunk_t* next = c->next;
+        free(c);
+        c = next;
+    }
+    free(heap);
+}
@@ -0,0 +1,129 @@
+#include "gram_pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+struct GramPool {
+    pthread_t* threads;
+    size_t thread_count;
+    pthread_mutex_t lock;
+    /// signals a new job (or `stop`) to the workers
+    pthread_cond_t start;
+    /// signals the end of the job to the thread that started it
+    pthread_cond_t done;
+    /// bumped for every job, so workers never run one twice
+    size_t generation;
+    /// workers still on the current job
+    size_t busy;
+    int stop;
+    gram_pool_fn fn;
+    void* arg;
+    size_t tasks;
+    /// next task to be claimed
+    size_t next;
+};
+
+typedef struct {
+    GramPool* pool;
+    size_t worker;
+} pool_worker_t;
+
+/// runs tasks of the current job until there are none left
+static void run_tasks(GramPool* p, size_t worker)
+{
+    size_t task;
+    while ((task = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED)) < p->tasks) {
+        p->fn(p->arg, task, worker);
+    }
+}
+
+static void* pool_worker(void* arg)
+{
+    pool_worker_t* w = arg;
+    GramPool* p = w->pool;
+    size_t seen = 0;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->stop && p->generation == seen)
+            pthread_cond_wait(&p->start, &p->lock);
+        if (p->stop)
+            break;
+        seen = p->generation;
+        pthread_mutex_unlock(&p->lock);
+        run_tasks(p, w->worker);
+        pthread_mutex_lock(&p->lock);
+        if (--p->busy == 0)
+            pthread_cond_signal(&p->done);
+    }
+    pthread_mutex_unlock(&p->lock);
+    free(w);
+    return NULL;
+}
+
+GramPool* gram_pool_new(size_t threads)
+{
+    if (threads < 2)
+        return NULL;
+    GramPool* p = calloc(1, sizeof(GramPool));
+    p->threads = calloc(threads - 1, sizeof(pthread_t));
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->done, NULL);
+    for (size_t i = 0; i < threads - 1; i++) {
+        pool_worker_t* w = malloc(sizeof(pool_worker_t));
+        // worker 0 is the thread starting the jobs
+        *w = (pool_worker_t) { .pool = p, .worker = i + 1 };
+        if (pthread_create(&p->threads[i], NULL, pool_worker, w)) {
+            free(w);
+            break;
+        }
+        p->thread_count++;
+    }
+    if (!p->thread_count) {
+        gram_pool_free(p);
+        return NULL;
+    }
+    return p;
+}
+
+size_t gram_pool_threads(const GramPool* pool)
+{
+    return pool ? pool->thread_count + 1 : 1;
+}
+
+void gram_pool_run(GramPool* p, size_t tasks, gram_pool_fn fn, void* arg)
+{
+    pthread_mutex_lock(&p->lock);
+    p->fn = fn;
+    p->arg = arg;
+    p->tasks = tasks;
+    p->next = 0;
+    p->busy = p->thread_count;
+    p->generation++;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+
+    run_tasks(p, 0);
+
+    pthread_mutex_lock(&p->lock);
+    while (p->busy)
+        pthread_cond_wait(&p->done, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void gram_pool_free(GramPool* p)
+{
+    if (!p)
+        return;
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+    for (size_t i = 0; i < p->thread_count; i++) {
+        pthread_join(p->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->start);
+    pthread_cond_destroy(&p->done);
+    free(p->threads);
+    free(p);
+}
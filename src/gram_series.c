@@ -0,0 +1,244 @@
+#include "gram_series.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && !defined(GRAM_NO_SIMD)
+#define GRAM_SERIES_X86 1
+#include <immintrin.h>
+#endif
+
+/// alignment of the buffer in bytes, a cache line
+#define SERIES_ALIGN 64
+#define SERIES_ALIGN_FLOATS (SERIES_ALIGN / sizeof(float))
+
+typedef void (*range_fn)(const float*, size_t, float*, float*);
+
+static void range_scalar(const float* v, size_t n, float* min, float* max)
+{
+    float lo = *min, hi = *max;
+    for (size_t i = 0; i < n; i++) {
+        // NaN compares false, so it is skipped just like fmin and fmax do
+        lo = v[i] < lo ? v[i] : lo;
+        hi = v[i] > hi ? v[i] : hi;
+    }
+    *min = lo;
+    *max = hi;
+}
+
+/// folds the lanes of the accumulators into `*min`/`*max`
+static void range_lanes(const float* lo, const float* hi, size_t lanes, float* min, float* max)
+{
+    for (size_t i = 0; i < lanes; i++) {
+        *min = lo[i] < *min ? lo[i] : *min;
+        *max = hi[i] > *max ? hi[i] : *max;
+    }
+}
+
+#ifdef GRAM_SERIES_X86
+// min/max return their second operand if either one is NaN, so the values go first
+// and a NaN leaves the accumulator as it was
+
+static void range_sse(const float* v, size_t n, float* min, float* max)
+{
+    __m128 lo0 = _mm_set1_ps(*min), lo1 = lo0;
+    __m128 hi0 = _mm_set1_ps(*max), hi1 = hi0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128 a = _mm_loadu_ps(v + i);
+        __m128 b = _mm_loadu_ps(v + i + 4);
+        lo0 = _mm_min_ps(a, lo0);
+        lo1 = _mm_min_ps(b, lo1);
+        hi0 = _mm_max_ps(a, hi0);
+        hi1 = _mm_max_ps(b, hi1);
+    }
+    float lo[4], hi[4];
+    _mm_storeu_ps(lo, _mm_min_ps(lo0, lo1));
+    _mm_storeu_ps(hi, _mm_max_ps(hi0, hi1));
+    range_lanes(lo, hi, 4, min, max);
+    range_scalar(v + i, n - i, min, max);
+}
+
+__attribute__((target("avx"))) static void range_avx(const float* v, size_t n, float* min, float* max)
+{
+    __m256 lo0 = _mm256_set1_ps(*min), lo1 = lo0;
+    __m256 hi0 = _mm256_set1_ps(*max), hi1 = hi0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 a = _mm256_loadu_ps(v + i);
+        __m256 b = _mm256_loadu_ps(v + i + 8);
+        lo0 = _mm256_min_ps(a, lo0);
+        lo1 = _mm256_min_ps(b, lo1);
+        hi0 = _mm256_max_ps(a, hi0);
+        hi1 = _mm256_max_ps(b, hi1);
+    }
+    float lo[8], hi[8];
+    _mm256_storeu_ps(lo, _mm256_min_ps(lo0, lo1));
+    _mm256_storeu_ps(hi, _mm256_max_ps(hi0, hi1));
+    range_lanes(lo, hi, 8, min, max);
+    range_scalar(v + i, n - i, min, max);
+}
+#endif
+
+static range_fn range = NULL;
+static const char* range_name = NULL;
+static pthread_once_t range_once = PTHREAD_ONCE_INIT;
+
+static void select_impl(void)
+{
+    const char* force = getenv("GRAM_RANGE");
+    if (force && strcmp(force, "scalar") == 0) {
+        range_name = "scalar";
+        range = range_scalar;
+        return;
+    }
+#ifdef GRAM_SERIES_X86
+    if (__builtin_cpu_supports("avx")) {
+        range_name = "avx";
+        range = range_avx;
+    } else {
+        range_name = "sse";
+        range = range_sse;
+    }
+#else
+    range_name = "scalar";
+    range = range_scalar;
+#endif
+}
+
+const char* gram_series_impl(void)
+{
+    pthread_once(&range_once, select_impl);
+    return range_name;
+}
+
+/// an aligned buffer of at least `floats` floats, the number of floats it holds goes to `cap`
+static float* series_alloc(size_t floats, size_t* cap)
+{
+    *cap = (floats + SERIES_ALIGN_FLOATS - 1) / SERIES_ALIGN_FLOATS * SERIES_ALIGN_FLOATS;
+    return *cap ? aligned_alloc(SERIES_ALIGN, *cap * sizeof(float)) : NULL;
+}
+
+/// zeroes the samples `from..to` of every dimension
+static void zero_samples(GramSeries* s, size_t from, size_t to)
+{
+    if (from >= to)
+        return;
+    if (s->layout == GRAM_SERIES_ROWS) {
+        memset(&s->data[from * s->dim], 0, (to - from) * s->dim * sizeof(float));
+        return;
+    }
+    for (size_t d = 0; d < s->dim; d++) {
+        memset(&s->data[d * s->time_cap + from], 0, (to - from) * sizeof(float));
+    }
+}
+
+void gram_series_reset(GramSeries* s, size_t time, size_t dim, GramSeriesLayout layout)
+{
+    if (time * dim > s->cap) {
+        free(s->data);
+        s->data = series_alloc(time * dim, &s->cap);
+    }
+    s->time = time;
+    s->dim = dim;
+    s->layout = layout;
+    // columns spread out over the whole buffer, so it can take more samples without moving
+    s->time_cap = dim ? s->cap / dim : 0;
+    zero_samples(s, 0, time);
+}
+
+void gram_series_set_time(GramSeries* s, size_t time)
+{
+    if (!s->dim) {
+        s->time = time;
+        return;
+    }
+    if (time > s->time_cap) {
+        // grown by half again, so following a file does not move the samples on every poll
+        size_t time_cap = s->time_cap + s->time_cap / 2;
+        time_cap = time > time_cap ? time : time_cap;
+        size_t cap;
+        float* data = series_alloc(time_cap * s->dim, &cap);
+        if (s->time && s->layout == GRAM_SERIES_ROWS) {
+            memcpy(data, s->data, s->time * s->dim * sizeof(float));
+        } else if (s->time) {
+            for (size_t d = 0; d < s->dim; d++) {
+                memcpy(&data[d * (cap / s->dim)], &s->data[d * s->time_cap], s->time * sizeof(float));
+            }
+        }
+        free(s->data);
+        s->data = data;
+        s->cap = cap;
+        s->time_cap = cap / s->dim;
+    }
+    zero_samples(s, s->time, time);
+    s->time = time;
+}
+
+void gram_series_copy(GramSeries* dst, const GramSeries* src)
+{
+    if (dst->cap < src->cap) {
+        free(dst->data);
+        dst->data = series_alloc(src->cap, &dst->cap);
+    }
+    dst->time = src->time;
+    dst->dim = src->dim;
+    dst->layout = src->layout;
+    dst->time_cap = src->dim ? dst->cap / src->dim : 0;
+    if (src->layout == GRAM_SERIES_ROWS) {
+        memcpy(dst->data, src->data, src->time * src->dim * sizeof(float));
+        return;
+    }
+    for (size_t d = 0; d < src->dim; d++) {
+        memcpy(&dst->data[d * dst->time_cap], &src->data[d * src->time_cap], src->time * sizeof(float));
+    }
+}
+
+void gram_series_free(GramSeries* s)
+{
+    free(s->data);
+    *s = (GramSeries) { 0 };
+}
+
+void gram_series_range(const GramSeries* s, size_t from, size_t to, float* min, float* max)
+{
+    pthread_once(&range_once, select_impl);
+    to = to < s->time ? to : s->time;
+    if (from >= to)
+        return;
+    if (s->layout == GRAM_SERIES_ROWS) {
+        range(&s->data[from * s->dim], (to - from) * s->dim, min, max);
+        return;
+    }
+    for (size_t d = 0; d < s->dim; d++) {
+        range(&s->data[d * s->time_cap + from], to - from, min, max);
+    }
+}
+
+void gram_series_envelope(const GramSeries* s, size_t from, size_t to, size_t columns, float* min, float* max)
+{
+    pthread_once(&range_once, select_impl);
+    to = to < s->time ? to : s->time;
+    while (from < to) {
+        size_t c = from * columns / s->time;
+        // the first sample of the next column
+        size_t end = ((c + 1) * s->time + columns - 1) / columns;
+        end = end < to ? end : to;
+        for (size_t d = 0; d < s->dim; d++) {
+            float* lo = &min[c * s->dim + d];
+            float* hi = &max[c * s->dim + d];
+            if (s->layout == GRAM_SERIES_COLUMNS) {
+                range(&s->data[d * s->time_cap + from], end - from, lo, hi);
+            } else if (s->dim == 1) {
+                range(&s->data[from], end - from, lo, hi);
+            } else {
+                for (size_t t = from; t < end; t++) {
+                    float v = s->data[t * s->dim + d];
+                    *lo = v < *lo ? v : *lo;
+                    *hi = v > *hi ? v : *hi;
+                }
+            }
+        }
+        from = end;
+    }
+}
@@ -12,6 +12,18 @@
 void gram_update(float t, float* ret){
     *ret = t;
 }
+/// optional, used instead of `gram_update` if defined. Called with `n` times at once,
+/// the values of `t[i]` go to `out[i * stride]` (`stride` is at least DIM)
+void gram_update_batch(const float* t, size_t n, float* out, size_t stride){
+    for (size_t i = 0; i < n; i++) {
+        out[i * stride] = t[i];
+    }
+}
+/// optional, GRAM_FLAG_PURE lets gram evaluate `gram_update` on several threads at once,
+/// leave it out if it keeps state between calls
+int gram_get_flags(void){
+    return GRAM_FLAG_PURE;
+}
 /// this function returns the value indicating what style the graph should be drawn in
 int gram_get_draw_type(){
     return GRAM_DRAW_RECT;
@@ -1,13 +1,17 @@
 #include "loadfns.h"
 #include "gram.h"
 #include "gram_csv.h"
+#include "gram_lua_compat.h"
+#include "gram_lua_heap.h"
 #include <ctype.h>
 #include <dlfcn.h>
 #include <lauxlib.h>
 #include <lua.h>
 #include <lualib.h>
+#include <pthread.h>
 #include <raylib.h>
 #include <raymath.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -35,6 +39,82 @@ static size_t StartAt = 0;
 static float Step = 1;
 static const char* LuaSrc = NULL;
 
+/// a state evaluating samples, along with the references it looks its functions and tables up by
+typedef struct {
+    lua_State* l;
+    /// memory of the state, NULL for the state of the script (main.c owns that one)
+    GramLuaHeap* heap;
+    /// registry references of `Update` and `UpdateRange`, looked up once per script
+    int update_ref;
+    int update_range_ref;
+    /// registry references of the `t` and `out` tables handed to `UpdateRange`, reused while
+    /// batches fit into `range_cap` samples
+    int range_t_ref;
+    int range_out_ref;
+    size_t range_cap;
+    /// registry reference of `UpdateBuffer` wrapped to get FFI pointers, only with LuaJIT
+    int update_buffer_ref;
+} lua_eval_t;
+
+#define LUA_EVAL_INIT(L)                                                                       \
+    (lua_eval_t)                                                                               \
+    {                                                                                          \
+        .l = (L), .update_ref = LUA_NOREF, .update_range_ref = LUA_NOREF,                     \
+        .range_t_ref = LUA_NOREF, .range_out_ref = LUA_NOREF, .update_buffer_ref = LUA_NOREF  \
+    }
+
+/// the state of the script
+static lua_eval_t Main = LUA_EVAL_INIT(NULL);
+/// states of the other workers of a pure script, `Workers[w - 1]` evaluates for worker `w`
+static lua_eval_t* Workers = NULL;
+static size_t WorkerCount = 0;
+/// set if the workers could not be set up, they are not tried again before a reload
+static int WorkersFailed = 0;
+/// set while the script runs in the state of a worker
+static int InWorker = 0;
+/// the state the calling thread evaluates with, NULL for the state of the script
+static _Thread_local lua_eval_t* Bound = NULL;
+
+/// columns of a csv file loaded by a script, shared by the states of every worker.
+/// The `lua_csv_t*` userdata each state gets holds a reference, its `__gc` drops it
+typedef struct lua_csv_t {
+    /// `&loaded`, `&follow.csv` for a followed file (growing in place on every poll),
+    /// NULL if the load failed
+    CSVFile* csv;
+    CSVFile loaded;
+    GramCsvFollow follow;
+    /// how the file was loaded, its path and the selected columns
+    char* key;
+    size_t refs;
+    struct lua_csv_t* next;
+} lua_csv_t;
+
+/// every csv file referenced by a state, states of workers may be collected on any thread
+static lua_csv_t* Shared = NULL;
+static pthread_mutex_t SharedLock = PTHREAD_MUTEX_INITIALIZER;
+
+/// userdata reading `len` rows of a column from `from` on, straight from the C buffers
+typedef struct {
+    const lua_csv_t* owner;
+    size_t col;
+    size_t from;
+    /// SIZE_MAX for a whole column, which grows along with a followed file
+    size_t len;
+} lua_csv_column_t;
+
+#define CSV_META "gram.csv"
+#define CSV_COLUMN_META "gram.csv.column"
+
+/// a csv file opened with `Gram.follow_csv`, rows appended to it show up in its column views
+typedef struct {
+    lua_csv_t* csv;
+    /// registry reference of `csv`, LUA_NOREF once it is not followed anymore
+    int ref;
+} lua_follow_t;
+
+static lua_follow_t* Follows = NULL;
+static size_t FollowCount = 0;
+
 char* stolower(const char* str)
 {
     size_t str_len = strlen(str);
@@ -89,6 +169,15 @@ void load_from_so(const char* p, GramExtFns* fns)
 
     _LOAD_FN(fns->gram_get_start_at, fns->lib, gram_get_start_at);
     _LOAD_ERR(fns->gram_get_start_at, gram_get_start_at, p);
+
+    // plugins that define it get whole ranges of samples to evaluate, `gram_update` stays the fallback
+    _LOAD_FN(fns->gram_update_batch, fns->lib, gram_update_batch);
+
+    // plugins without it are evaluated in order on a single thread
+    _LOAD_FN(fns->gram_get_flags, fns->lib, gram_get_flags);
+
+    // only plugins that serve data which can grow define it
+    _LOAD_FN(fns->gram_poll, fns->lib, gram_poll);
 }
 static size_t l_gram_get_time()
 {
@@ -106,41 +195,194 @@ static size_t l_gram_get_time()
     return t;
 }
 
+/// pushes the global function `name`, kept in the registry under `*ref` after the first lookup.
+/// Returns 0 (pushing nothing) if there is no such function
+static int push_cached_fn(lua_State* l, const char* name, int* ref)
+{
+    if (*ref == LUA_NOREF) {
+        lua_getglobal(l, name);
+        if (!lua_isfunction(l, -1)) {
+            lua_pop(l, 1);
+            return 0;
+        }
+        *ref = luaL_ref(l, LUA_REGISTRYINDEX);
+    }
+    lua_rawgeti(l, LUA_REGISTRYINDEX, *ref);
+    return 1;
+}
+
 static void l_gram_update(float t, float* row)
 {
-    lua_getglobal(L, STRINGIFY(Update));
-    if (!lua_isfunction(L, -1)) {
+    lua_eval_t* e = Bound ? Bound : &Main;
+    lua_State* l = e->l;
+    if (!push_cached_fn(l, STRINGIFY(Update), &e->update_ref)) {
         TraceLog(LOG_ERROR, "Could not find " STRINGIFY(Update) " function in lua script");
-        lua_settop(L, 0);
+        lua_settop(l, 0);
         return;
     }
-    lua_pushnumber(L, t);
+    lua_pushnumber(l, t);
     if (Dim <= 0) {
-        lua_settop(L, 0);
+        lua_settop(l, 0);
         return;
     }
-    if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+    if (lua_pcall(l, 1, 1, 0) != LUA_OK) {
         TraceLog(LOG_ERROR, "Error while calling" STRINGIFY(Update) " function in lua script %s",
-            lua_tostring(L, -1));
-        lua_settop(L, 0);
+            lua_tostring(l, -1));
+        lua_settop(l, 0);
         return;
     }
-    if (lua_isnumber(L, -1) && Dim == 1) {
-        row[0] = lua_tonumber(L, -1);
-    } else if (lua_istable(L, -1)) {
-        size_t ret_len = lua_rawlen(L, -1);
+    if (lua_isnumber(l, -1) && Dim == 1) {
+        row[0] = lua_tonumber(l, -1);
+    } else if (lua_istable(l, -1)) {
+        size_t ret_len = lua_rawlen(l, -1);
         for (size_t i = 0; (i < Dim) && (i < ret_len); i++) {
-            int ty = lua_rawgeti(L, -1, i + 1);
+            int ty = lua_rawgeti(l, -1, i + 1);
             if (ty == LUA_TNUMBER) {
-                row[i] = lua_tonumber(L, -1);
+                row[i] = lua_tonumber(l, -1);
             }
-            lua_pop(L, 1);
+            lua_pop(l, 1);
         }
     } else {
         TraceLog(LOG_ERROR, STRINGIFY(Update) " function returned a disallowed value");
     }
-    lua_settop(L, 0);
+    lua_settop(l, 0);
+}
+/// makes the `t` table and the `Dim` tables of `out` big enough for `n` samples
+static void range_tables_reserve(lua_eval_t* e, size_t n)
+{
+    if (n <= e->range_cap)
+        return;
+    lua_State* l = e->l;
+    luaL_unref(l, LUA_REGISTRYINDEX, e->range_t_ref);
+    luaL_unref(l, LUA_REGISTRYINDEX, e->range_out_ref);
+    lua_createtable(l, n, 0);
+    e->range_t_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+    lua_createtable(l, Dim, 0);
+    for (size_t d = 0; d < Dim; d++) {
+        lua_createtable(l, n, 0);
+        for (size_t i = 0; i < n; i++) {
+            lua_pushnumber(l, 0);
+            lua_rawseti(l, -2, i + 1);
+        }
+        lua_rawseti(l, -2, d + 1);
+    }
+    e->range_out_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+    e->range_cap = n;
+}
+
+/// calls `UpdateRange(t, n, out)` once for `n` samples, the script sets `out[d][i]` to
+/// dimension `d` of the sample at `t[i]`. Values it leaves unset are left as they are in
+/// `out`, like those `Update` does not return
+static void l_gram_update_batch(const float* t, size_t n, float* out, size_t stride)
+{
+    if (Dim <= 0 || !n)
+        return;
+    lua_eval_t* e = Bound ? Bound : &Main;
+    lua_State* l = e->l;
+    if (!push_cached_fn(l, STRINGIFY(UpdateRange), &e->update_range_ref)) {
+        TraceLog(LOG_ERROR, "Could not find " STRINGIFY(UpdateRange) " function in lua script");
+        lua_settop(l, 0);
+        return;
+    }
+    range_tables_reserve(e, n);
+    lua_rawgeti(l, LUA_REGISTRYINDEX, e->range_t_ref);
+    for (size_t i = 0; i < n; i++) {
+        lua_pushnumber(l, t[i]);
+        lua_rawseti(l, -2, i + 1);
+    }
+    lua_pushinteger(l, n);
+    lua_rawgeti(l, LUA_REGISTRYINDEX, e->range_out_ref);
+    // the tables are reused, values of the previous batch must not be taken for unset ones
+    for (size_t d = 0; d < Dim; d++) {
+        if (lua_rawgeti(l, -1, d + 1) == LUA_TTABLE) {
+            for (size_t i = 0; i < n; i++) {
+                lua_pushnil(l);
+                lua_rawseti(l, -2, i + 1);
+            }
+        }
+        lua_pop(l, 1);
+    }
+    if (lua_pcall(l, 3, 0, 0) != LUA_OK) {
+        TraceLog(LOG_ERROR, "Error while calling " STRINGIFY(UpdateRange) " function in lua script %s",
+            lua_tostring(l, -1));
+        lua_settop(l, 0);
+        return;
+    }
+    lua_rawgeti(l, LUA_REGISTRYINDEX, e->range_out_ref);
+    for (size_t d = 0; d < Dim; d++) {
+        if (lua_rawgeti(l, -1, d + 1) != LUA_TTABLE) {
+            lua_pop(l, 1);
+            continue;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (lua_rawgeti(l, -1, i + 1) == LUA_TNUMBER) {
+                out[i * stride + d] = lua_tonumber(l, -1);
+            }
+            lua_pop(l, 1);
+        }
+        lua_pop(l, 1);
+    }
+    lua_settop(l, 0);
+}
+
+#ifdef GRAM_LUAJIT
+/// turns `UpdateBuffer` into a function taking the pointers as light userdata, which are cast
+/// to FFI pointers so the traces of the script write the samples straight to memory
+static const char UpdateBufferWrapper[] = "local ffi, fn = require('ffi'), ...\n"
+                                          "local cast = ffi.cast\n"
+                                          "local ct, cout = ffi.typeof('const float*'), ffi.typeof('float*')\n"
+                                          "return function(t, n, out, stride)\n"
+                                          "    fn(cast(ct, t), n, cast(cout, out), stride)\n"
+                                          "end\n";
+
+/// pushes the wrapped `UpdateBuffer` of `e`, returns 0 (pushing nothing) if the script has none
+static int push_buffer_fn(lua_eval_t* e)
+{
+    lua_State* l = e->l;
+    if (e->update_buffer_ref == LUA_NOREF) {
+        if (lua_getglobal(l, STRINGIFY(UpdateBuffer)) != LUA_TFUNCTION) {
+            lua_pop(l, 1);
+            return 0;
+        }
+        if (luaL_loadstring(l, UpdateBufferWrapper) != LUA_OK) {
+            lua_pop(l, 2);
+            return 0;
+        }
+        lua_insert(l, -2);
+        if (lua_pcall(l, 1, 1, 0) != LUA_OK) {
+            TraceLog(LOG_ERROR, "Cannot wrap " STRINGIFY(UpdateBuffer) " function in lua script %s",
+                lua_tostring(l, -1));
+            lua_pop(l, 1);
+            return 0;
+        }
+        e->update_buffer_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+    }
+    lua_rawgeti(l, LUA_REGISTRYINDEX, e->update_buffer_ref);
+    return 1;
 }
+
+/// calls `UpdateBuffer(t, n, out, stride)` with FFI pointers, the script writes dimension `d`
+/// of the sample at `t[i]` to `out[i * stride + d]` (counting from 0)
+static void l_gram_update_buffer(const float* t, size_t n, float* out, size_t stride)
+{
+    if (Dim <= 0 || !n)
+        return;
+    lua_eval_t* e = Bound ? Bound : &Main;
+    lua_State* l = e->l;
+    if (!push_buffer_fn(e))
+        return;
+    lua_pushlightuserdata(l, (void*)t);
+    lua_pushinteger(l, n);
+    lua_pushlightuserdata(l, out);
+    lua_pushinteger(l, stride);
+    if (lua_pcall(l, 4, 0, 0) != LUA_OK) {
+        TraceLog(LOG_ERROR, "Error while calling " STRINGIFY(UpdateBuffer) " function in lua script %s",
+            lua_tostring(l, -1));
+    }
+    lua_settop(l, 0);
+}
+#endif
+
 static int l_gram_get_draw_type()
 {
     lua_getglobal(L, STRINGIFY(Draw));
@@ -285,9 +527,253 @@ static void l_gram_fini()
     }
 }
 
-static void make_csv_table(lua_State* l, CSVFile* csv)
+/// drops a reference to `c`, the last one frees it
+static void csv_release(lua_csv_t* c)
+{
+    pthread_mutex_lock(&SharedLock);
+    if (--c->refs) {
+        pthread_mutex_unlock(&SharedLock);
+        return;
+    }
+    for (lua_csv_t** p = &Shared; *p; p = &(*p)->next) {
+        if (*p == c) {
+            *p = c->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&SharedLock);
+    if (c->csv == &c->follow.csv) {
+        gram_csv_follow_free(&c->follow);
+    } else if (c->csv == &c->loaded) {
+        gram_csv_csv_file_free(c->loaded);
+    }
+    free(c->key);
+    free(c);
+}
+
+/// takes a reference to the file loaded as `key`, NULL if no state loaded it yet
+static lua_csv_t* csv_acquire(const char* key)
+{
+    pthread_mutex_lock(&SharedLock);
+    lua_csv_t* c = Shared;
+    while (c && strcmp(c->key, key) != 0) {
+        c = c->next;
+    }
+    if (c)
+        c->refs++;
+    pthread_mutex_unlock(&SharedLock);
+    return c;
+}
+
+/// lets the states of the other workers find `c` once it is loaded
+static void csv_publish(lua_csv_t* c)
+{
+    pthread_mutex_lock(&SharedLock);
+    c->next = Shared;
+    Shared = c;
+    pthread_mutex_unlock(&SharedLock);
+}
+
+static int l_csv_gc(lua_State* l)
+{
+    lua_csv_t** c = luaL_checkudata(l, 1, CSV_META);
+    if (*c)
+        csv_release(*c);
+    *c = NULL;
+    return 0;
+}
+
+/// pushes a userdata holding a reference to `c`, a new file loaded as `key` (taking it over) if NULL
+static lua_csv_t* push_csv_owner(lua_State* l, lua_csv_t* c, char* key)
+{
+    lua_csv_t** u = lua_newuserdatauv(l, sizeof(lua_csv_t*), 0);
+    if (!c) {
+        c = calloc(1, sizeof(lua_csv_t));
+        *c = (lua_csv_t) { .follow = { .fd = -1 }, .key = key, .refs = 1 };
+    }
+    *u = c;
+    if (luaL_newmetatable(l, CSV_META)) {
+        lua_pushcfunction(l, l_csv_gc);
+        lua_setfield(l, -2, "__gc");
+    }
+    lua_setmetatable(l, -2);
+    return c;
+}
+
+static size_t csv_column_len(const lua_csv_column_t* v)
+{
+    if (v->len != SIZE_MAX)
+        return v->len;
+    return v->owner->csv ? v->owner->csv->col_len - v->from : 0;
+}
+
+/// pushes row `row` of the column, text cells as strings
+static void push_csv_cell(lua_State* l, const lua_csv_column_t* v, size_t row)
+{
+    const CSVFile* csv = v->owner->csv;
+    if (csv->columns[v->col]) {
+        lua_pushnumber(l, csv->columns[v->col][row]);
+    } else if (gram_csv_column_type(csv, v->col) == GRAMCSV_TYPE_DICT) {
+        lua_pushstring(l, gram_csv_text(csv, v->col, row));
+    } else {
+        lua_pushnumber(l, gram_csv_value(csv, v->col, row));
+    }
+}
+
+/// pushes a view of `len` rows of `v` from `from` on, sharing its owner
+static void push_csv_column(lua_State* l, int v_idx, const lua_csv_column_t* v, size_t from, size_t len)
+{
+    lua_csv_column_t* s = lua_newuserdatauv(l, sizeof(lua_csv_column_t), 1);
+    *s = (lua_csv_column_t) { .owner = v->owner, .col = v->col, .from = v->from + from, .len = len };
+    lua_getiuservalue(l, v_idx, 1);
+    lua_setiuservalue(l, -2, 1);
+    luaL_setmetatable(l, CSV_COLUMN_META);
+}
+
+/// `col:slice(i [, j])`, a view of the rows `i..j` (inclusive, negative ones count from the end
+/// like `string.sub` does), nothing is copied
+static int l_csv_column_slice(lua_State* l)
+{
+    const lua_csv_column_t* v = luaL_checkudata(l, 1, CSV_COLUMN_META);
+    lua_Integer len = csv_column_len(v);
+    lua_Integer i = luaL_checkinteger(l, 2);
+    lua_Integer j = luaL_optinteger(l, 3, -1);
+    i = i < 0 ? len + i + 1 : i;
+    j = j < 0 ? len + j + 1 : j;
+    i = i < 1 ? 1 : i;
+    j = j > len ? len : j;
+    push_csv_column(l, 1, v, i - 1, i <= j ? j - i + 1 : 0);
+    return 1;
+}
+
+/// `col:totable()`, copies the rows into a plain sequence for the functions of the `table` library
+static int l_csv_column_totable(lua_State* l)
+{
+    const lua_csv_column_t* v = luaL_checkudata(l, 1, CSV_COLUMN_META);
+    size_t len = csv_column_len(v);
+    lua_createtable(l, len, 0);
+    for (size_t i = 0; i < len; i++) {
+        push_csv_cell(l, v, v->from + i);
+        lua_rawseti(l, -2, i + 1);
+    }
+    return 1;
+}
+
+#ifdef GRAM_LUAJIT
+/// key of `ffi.cast` in the registry
+#define FFI_CAST "gram.ffi.cast"
+
+/// `col:ptr()`, an FFI pointer to the first row of the view in the type the column is stored as
+/// (`const double*`, `const float*`, `const int32_t*`, or the `const uint32_t*` dictionary codes of
+/// text), indexed from 0. It does not keep the column alive, and the columns of followed files
+/// move whenever rows are appended
+static int l_csv_column_ptr(lua_State* l)
 {
-    lua_createtable(l, 0, csv->header_count + 1);
+    static const char* types[] = {
+        [GRAMCSV_TYPE_DOUBLE] = "const double*",
+        [GRAMCSV_TYPE_FLOAT] = "const float*",
+        [GRAMCSV_TYPE_INT32] = "const int32_t*",
+        [GRAMCSV_TYPE_DICT] = "const uint32_t*",
+    };
+    static const size_t sizes[] = { 8, 4, 4, 4 };
+    const lua_csv_column_t* v = luaL_checkudata(l, 1, CSV_COLUMN_META);
+    const CSVFile* csv = v->owner->csv;
+    GramCsvType ty = gram_csv_column_type(csv, v->col);
+    const char* data = csv->columns[v->col] ? (const char*)csv->columns[v->col] : csv->typed[v->col].data;
+    lua_getfield(l, LUA_REGISTRYINDEX, FFI_CAST);
+    if (lua_isnil(l, -1)) {
+        lua_pop(l, 1);
+        if (luaL_dostring(l, "return require('ffi').cast"))
+            return lua_error(l);
+        lua_pushvalue(l, -1);
+        lua_setfield(l, LUA_REGISTRYINDEX, FFI_CAST);
+    }
+    lua_pushstring(l, types[ty]);
+    lua_pushlightuserdata(l, (void*)(data + v->from * sizes[ty]));
+    lua_call(l, 2, 1);
+    return 1;
+}
+#endif
+
+/// step of `for i, x in ipairs(col)` for the versions of lua asking `__ipairs`
+static int l_csv_column_next(lua_State* l)
+{
+    const lua_csv_column_t* v = luaL_checkudata(l, 1, CSV_COLUMN_META);
+    lua_Integer i = luaL_checkinteger(l, 2) + 1;
+    if ((size_t)i > csv_column_len(v))
+        return 0;
+    lua_pushinteger(l, i);
+    push_csv_cell(l, v, v->from + i - 1);
+    return 2;
+}
+
+static int l_csv_column_ipairs(lua_State* l)
+{
+    lua_pushcfunction(l, l_csv_column_next);
+    lua_pushvalue(l, 1);
+    lua_pushinteger(l, 0);
+    return 3;
+}
+
+/// `col[i]` reads row `i` (from 1 on, nil past the end), names look up the methods
+static int l_csv_column_index(lua_State* l)
+{
+    const lua_csv_column_t* v = lua_touserdata(l, 1);
+    int is_int;
+    lua_Integer i = lua_tointegerx(l, 2, &is_int);
+    if (is_int) {
+        if (i < 1 || (size_t)i > csv_column_len(v)) {
+            lua_pushnil(l);
+        } else {
+            push_csv_cell(l, v, v->from + i - 1);
+        }
+        return 1;
+    }
+    lua_pushvalue(l, 2);
+    lua_rawget(l, lua_upvalueindex(1));
+    return 1;
+}
+
+static int l_csv_column_len(lua_State* l)
+{
+    lua_pushinteger(l, csv_column_len(lua_touserdata(l, 1)));
+    return 1;
+}
+
+static int l_csv_column_newindex(lua_State* l)
+{
+    return luaL_error(l, "csv columns are read only, copy them with `totable` first");
+}
+
+/// pushes the table `Gram.load_csv` returns for the csv referenced by the userdata on top of the
+/// stack, replacing it
+static void push_csv_table(lua_State* l)
+{
+    lua_csv_t* c = *(lua_csv_t**)lua_touserdata(l, -1);
+    CSVFile* csv = c->csv;
+    if (luaL_newmetatable(l, CSV_COLUMN_META)) {
+        lua_createtable(l, 0, 2);
+        lua_pushcfunction(l, l_csv_column_slice);
+        lua_setfield(l, -2, "slice");
+        lua_pushcfunction(l, l_csv_column_totable);
+        lua_setfield(l, -2, "totable");
+#ifdef GRAM_LUAJIT
+        lua_pushcfunction(l, l_csv_column_ptr);
+        lua_setfield(l, -2, "ptr");
+#endif
+        lua_pushcclosure(l, l_csv_column_index, 1);
+        lua_setfield(l, -2, "__index");
+        lua_pushcfunction(l, l_csv_column_len);
+        lua_setfield(l, -2, "__len");
+        lua_pushcfunction(l, l_csv_column_newindex);
+        lua_setfield(l, -2, "__newindex");
+        // lua 5.4 iterates through `__index`, older versions ask `__ipairs`
+        lua_pushcfunction(l, l_csv_column_ipairs);
+        lua_setfield(l, -2, "__ipairs");
+    }
+    lua_pop(l, 1);
+
+    lua_createtable(l, 0, csv->header_count + 2);
     // set fname
     lua_pushstring(l, csv->file_name);
     lua_setfield(l, -2, "fname");
@@ -295,50 +781,301 @@ static void make_csv_table(lua_State* l, CSVFile* csv)
     lua_pushinteger(l, csv->col_count);
     lua_setfield(l, -2, "dim");
 
-    // // set headers
+    // a view per header, reading the columns where they are
     for (size_t h = 0; h < csv->header_count; h++) {
-        // header is a sequential table
-        lua_createtable(L, csv->col_len, 0);
-
-        // push all values
-        for (size_t i = 0; i < csv->col_len; i++) {
-            lua_pushnumber(L, csv->columns[h][i]);
-            lua_rawseti(L, -2, i + 1);
-        }
-        lua_setfield(L, -2, csv->headers[h]);
+        lua_csv_column_t* v = lua_newuserdatauv(l, sizeof(lua_csv_column_t), 1);
+        *v = (lua_csv_column_t) { .owner = c, .col = h, .len = SIZE_MAX };
+        lua_pushvalue(l, -3);
+        lua_setiuservalue(l, -2, 1);
+        luaL_setmetatable(l, CSV_COLUMN_META);
+        lua_setfield(l, -2, csv->headers[h]);
     }
+    lua_remove(l, -2);
+}
+
+void make_csv_table(lua_State* l, CSVFile* csv)
+{
+    lua_csv_t* c = push_csv_owner(l, NULL, NULL);
+    c->loaded = *csv;
+    c->csv = &c->loaded;
+    *csv = (CSVFile) { 0 };
+    push_csv_table(l);
 }
 
+/// length of the directory part of `src_path` including the trailing `/`
 size_t find_dir_prefix(const char* src_path)
 {
     size_t len = strlen(src_path);
     for (size_t i = len; i >= 1; i--) {
         if (src_path[i - 1] == '/')
-            return i - 1;
+            return i;
     }
     return 0;
 }
 
-static int l_load_csv(lua_State* l)
+/// reads the arguments shared by `load_csv` and `follow_csv` into `parser`, returns the path
+/// of the file relative to the script. Free it and `*select` after the load
+static char* csv_args(lua_State* l, GramCsvParser* parser, const char*** select)
 {
     const char* lpath = luaL_checkstring(l, 1);
     size_t dir_prefix = find_dir_prefix(LuaSrc);
     char* rel_path = calloc(dir_prefix + strlen(lpath) + 1, sizeof(char));
-    memcpy(rel_path, LuaSrc, dir_prefix + 1);
-    memcpy(rel_path + dir_prefix + 1, lpath, strlen(lpath));
-    CSVFile csv = { 0 };
-    if (gram_csv_load_csv(rel_path, &csv)) {
-        lua_pop(l, 1);
+    memcpy(rel_path, LuaSrc, dir_prefix);
+    memcpy(rel_path + dir_prefix, lpath, strlen(lpath));
+    gram_csv_parser_init(parser);
+    *select = NULL;
+    // optional list of the only headers the script needs, the other columns are never converted
+    if (lua_istable(l, 2)) {
+        parser->select_count = lua_rawlen(l, 2);
+        *select = calloc(parser->select_count + 1, sizeof(char*));
+        for (size_t i = 0; i < parser->select_count; i++) {
+            // the strings stay referenced by the table so the pointers outlive the pop
+            int ty = lua_rawgeti(l, 2, i + 1);
+            (*select)[i] = ty == LUA_TSTRING ? lua_tostring(l, -1) : NULL;
+            lua_pop(l, 1);
+            if (!(*select)[i]) {
+                free(*select);
+                free(rel_path);
+                luaL_argerror(l, 2, "column names have to be strings");
+            }
+        }
+        parser->select = *select;
+    }
+    return rel_path;
+}
+
+/// identifies a load of `rel_path` done with `parser`, `kind` tells `load_csv` and `follow_csv` apart
+static char* csv_key(char kind, const char* rel_path, const GramCsvParser* parser)
+{
+    size_t len = strlen(rel_path) + 2;
+    for (size_t i = 0; i < parser->select_count; i++) {
+        len += strlen(parser->select[i]) + 1;
+    }
+    char* key = malloc(len);
+    char* at = key;
+    *at++ = kind;
+    at = stpcpy(at, rel_path);
+    for (size_t i = 0; i < parser->select_count; i++) {
+        *at++ = '\n';
+        at = stpcpy(at, parser->select[i]);
+    }
+    return key;
+}
+
+static int l_load_csv(lua_State* l)
+{
+    GramCsvParser parser;
+    const char** select = NULL;
+    char* rel_path = csv_args(l, &parser, &select);
+    char* key = csv_key('l', rel_path, &parser);
+    // the states of the workers of a pure script get the columns the first one loaded
+    lua_csv_t* c = csv_acquire(key);
+    if (c) {
+        free(key);
+        free(select);
+        free(rel_path);
+        push_csv_owner(l, c, NULL);
+        push_csv_table(l);
+        return 1;
+    }
+    c = push_csv_owner(l, NULL, key);
+    parser.infer_types = 1;
+    // a `.gramcol` written by gram_csv next to the csv file is mapped instead of parsing the text
+    if (gram_csv_parser_load_cached(&parser, rel_path, &c->loaded)) {
+        lua_settop(l, 0);
         lua_pushnil(l);
-        TraceLog(LOG_ERROR, "CSV: %s", gram_csv_err_msg());
+        TraceLog(LOG_ERROR, "CSV: %s", gram_csv_parser_err_msg(&parser));
+        free(select);
+        free(rel_path);
+        return 1;
+    }
+    free(select);
+    free(rel_path);
+    c->csv = &c->loaded;
+    csv_publish(c);
+    push_csv_table(l);
+    return 1;
+}
+
+/// same as `load_csv`, but rows appended to the file later on show up in the columns
+/// (and `Append` is called) while gram runs in follow mode
+static int l_follow_csv(lua_State* l)
+{
+    GramCsvParser parser;
+    const char** select = NULL;
+    char* rel_path = csv_args(l, &parser, &select);
+    char* key = csv_key('f', rel_path, &parser);
+    lua_csv_t* c = csv_acquire(key);
+    if (c) {
+        free(key);
+        free(select);
         free(rel_path);
+        push_csv_owner(l, c, NULL);
+        push_csv_table(l);
         return 1;
     }
+    c = push_csv_owner(l, NULL, key);
+    int err = gram_csv_parser_follow(&parser, rel_path, &c->follow);
+    free(select);
     free(rel_path);
-    make_csv_table(l, &csv);
-    gram_csv_csv_file_free(csv);
+    if (err) {
+        lua_settop(l, 0);
+        lua_pushnil(l);
+        TraceLog(LOG_ERROR, "CSV: %s", gram_csv_parser_err_msg(&parser));
+        return 1;
+    }
+    c->csv = &c->follow.csv;
+    csv_publish(c);
+    // only the state of the script polls, the workers see the new rows through the shared columns
+    if (!InWorker) {
+        Follows = realloc(Follows, (FollowCount + 1) * sizeof(lua_follow_t));
+        lua_pushvalue(l, -1);
+        Follows[FollowCount++] = (lua_follow_t) { .csv = c, .ref = luaL_ref(l, LUA_REGISTRYINDEX) };
+    }
+    push_csv_table(l);
     return 1;
 }
+
+/// the followed files themselves are freed along with the states that referenced them
+static void follows_free()
+{
+    free(Follows);
+    Follows = NULL;
+    FollowCount = 0;
+}
+
+static size_t l_gram_poll()
+{
+    size_t total = 0;
+    for (size_t i = 0; i < FollowCount; i++) {
+        lua_follow_t* f = &Follows[i];
+        if (f->ref == LUA_NOREF)
+            continue;
+        GramCsvParser parser;
+        gram_csv_parser_init(&parser);
+        size_t rows = 0;
+        if (gram_csv_follow_poll(&parser, &f->csv->follow, &rows)) {
+            // the rows read so far stay in the views, the file is freed once they are collected
+            TraceLog(LOG_ERROR, "CSV: `%s` %s, no longer following it", f->csv->follow.csv.file_name,
+                gram_csv_parser_err_msg(&parser));
+            luaL_unref(L, LUA_REGISTRYINDEX, f->ref);
+            f->ref = LUA_NOREF;
+            continue;
+        }
+        total += rows;
+    }
+    if (!total || lua_getglobal(L, STRINGIFY(Append)) != LUA_TFUNCTION) {
+        lua_settop(L, 0);
+        return total;
+    }
+    lua_pushinteger(L, total);
+    if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+        TraceLog(LOG_ERROR, "Error while calling `" STRINGIFY(Append) "` function in lua script %s",
+            lua_tostring(L, -1));
+    }
+    lua_settop(L, 0);
+    return total;
+}
+
+/// scripts setting `Pure = true` only depend on `t` in `Update`/`UpdateRange`, so they
+/// are evaluated in parallel, each worker with a state of its own
+static int l_gram_get_flags()
+{
+    lua_getglobal(L, STRINGIFY(Pure));
+    int pure = lua_toboolean(L, -1);
+    lua_settop(L, 0);
+    return pure ? GRAM_FLAG_PURE : 0;
+}
+
+/// adds the `Gram` table of the functions scripts can call
+static void register_gram(lua_State* l)
+{
+    lua_createtable(l, 0, 2);
+    lua_pushcfunction(l, l_load_csv);
+    lua_setfield(l, -2, "load_csv");
+    lua_pushcfunction(l, l_follow_csv);
+    lua_setfield(l, -2, "follow_csv");
+    lua_setglobal(l, "Gram");
+#if LUA_VERSION_NUM < 502
+    // the column views are userdata, which `ipairs` only iterates through `__ipairs` from 5.2 on
+    if (luaL_dostring(l, "local ipairs_ = ipairs\n"
+                         "function ipairs(t)\n"
+                         "    local mt = getmetatable(t)\n"
+                         "    if type(mt) == 'table' and mt.__ipairs then return mt.__ipairs(t) end\n"
+                         "    return ipairs_(t)\n"
+                         "end\n"))
+        lua_pop(l, 1);
+#endif
+}
+
+static void workers_free()
+{
+    for (size_t i = 0; i < WorkerCount; i++) {
+        if (Workers[i].l)
+            lua_close(Workers[i].l);
+        gram_lua_heap_free(Workers[i].heap);
+    }
+    free(Workers);
+    Workers = NULL;
+    WorkerCount = 0;
+    WorkersFailed = 0;
+}
+
+/// runs the script and its `Init` in a new state of a worker, returns 0 if no error
+static int worker_start(lua_eval_t* e)
+{
+    e->heap = gram_lua_heap_new();
+    e->l = e->heap ? gram_lua_heap_state(e->heap) : NULL;
+    if (!e->l) {
+        TraceLog(LOG_ERROR, "Cannot make a lua state for a worker");
+        return 1;
+    }
+    luaL_openlibs(e->l);
+    register_gram(e->l);
+    InWorker = 1;
+    int err = luaL_loadfile(e->l, LuaSrc) || lua_pcall(e->l, 0, 0, 0);
+    if (!err && lua_getglobal(e->l, STRINGIFY(Init)) == LUA_TFUNCTION) {
+        err = lua_pcall(e->l, 0, 0, 0);
+    } else if (!err) {
+        lua_pop(e->l, 1);
+    }
+    InWorker = 0;
+    if (err) {
+        TraceLog(LOG_ERROR, "Cannot run configuration file in a worker: %s", lua_tostring(e->l, -1));
+    }
+    lua_settop(e->l, 0);
+#ifdef LUA_GCGEN
+    // workers do nothing but evaluate, which makes short lived garbage
+    lua_gc(e->l, LUA_GCGEN, 0, 0);
+#endif
+    return err;
+}
+
+/// starts a state for every worker but the first, which evaluates with the state of the script
+static int l_gram_prepare_workers(size_t workers)
+{
+    if (WorkersFailed || !LuaSrc)
+        return 0;
+    if (workers <= WorkerCount + 1)
+        return 1;
+    Workers = realloc(Workers, (workers - 1) * sizeof(lua_eval_t));
+    while (WorkerCount + 1 < workers) {
+        lua_eval_t* e = &Workers[WorkerCount++];
+        *e = LUA_EVAL_INIT(NULL);
+        if (worker_start(e)) {
+            workers_free();
+            WorkersFailed = 1;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void l_gram_bind_worker(size_t worker)
+{
+    Bound = worker && worker <= WorkerCount ? &Workers[worker - 1] : NULL;
+}
+
 static int l_gram_get_start_at()
 {
     StartAt = 0;
@@ -373,6 +1110,13 @@ void load_from_lua(const char* src, lua_State* l, GramExtFns* fns)
 {
     L = NULL;
     LuaSrc = NULL;
+    // the workers ran the previous script, which may be different now
+    workers_free();
+    Bound = NULL;
+    // references into the registry of the previous state
+    Main = LUA_EVAL_INIT(NULL);
+    // the followed files went away with the previous state
+    follows_free();
     if (luaL_loadfile(l, src) || lua_pcall(l, 0, 0, 0)) {
         TraceLog(LOG_ERROR, "Cannot run configuration file: %s",
             lua_tostring(l, -1));
@@ -388,12 +1132,20 @@ void load_from_lua(const char* src, lua_State* l, GramExtFns* fns)
     fns->gram_get_start_at = &l_gram_get_start_at;
     fns->gram_update = &l_gram_update;
     fns->gram_get_step = &l_gram_get_step;
+    fns->gram_poll = &l_gram_poll;
+    fns->gram_get_flags = &l_gram_get_flags;
+    fns->gram_prepare_workers = &l_gram_prepare_workers;
+    fns->gram_bind_worker = &l_gram_bind_worker;
     L = l;
+    Main.l = l;
+    // scripts defining `UpdateRange` are evaluated a batch of samples per call
+    fns->gram_update_batch = push_cached_fn(L, STRINGIFY(UpdateRange), &Main.update_range_ref) ? &l_gram_update_batch : NULL;
+#ifdef GRAM_LUAJIT
+    // `UpdateBuffer` writes the samples through FFI pointers, it is preferred when both are there
+    if (push_buffer_fn(&Main))
+        fns->gram_update_batch = &l_gram_update_buffer;
+#endif
+    lua_settop(L, 0);
 
-    // push the gram functions table
-    lua_createtable(L, 0, 1);
-    lua_pushstring(L, "load_csv");
-    lua_pushcfunction(L, l_load_csv);
-    lua_settable(L, 1);
-    lua_setglobal(L, "Gram");
+    register_gram(L);
 }
@@ -3,12 +3,18 @@
 #include <lua.h>
 #include <lualib.h>
 #include <math.h>
+#include <pthread.h>
 #include <raylib.h>
 #include <raymath.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "gram.h"
+#include "gram_lua_heap.h"
+#include "gram_pool.h"
+#include "gram_series.h"
 #include "loadfns.h"
 #define PLAP_IMPLEMENTATION
 #include "plap.h"
@@ -19,6 +25,19 @@
 #define DIM 1
 #define COL_MARGIN_PERCENT 0.20f
 #define EXTERNAL_MARGIN_PERCENT 0.1f
+/// seconds between two looks for appended data in follow mode
+#define FOLLOW_INTERVAL 0.25
+/// samples handed to `gram_update_batch` at a time
+#define BATCH_SAMPLES 4096
+/// fewer samples than this are not worth spreading over threads
+#define PARALLEL_MIN_SAMPLES (BATCH_SAMPLES * 4)
+#define TASKS_PER_THREAD 4
+/// seconds a job runs before its progress is shown, follows mostly take less
+#define PROGRESS_DELAY 0.2
+/// seconds of a frame spent folding ready samples into the envelope, the rest is left for drawing
+#define FRAME_BUDGET 0.008
+/// samples folded into the envelope between two looks at the clock
+#define FOLD_SAMPLES (1 << 16)
 
 const GramColor DEFAULT_COLORS[] = {
     GRAM_RED,
@@ -45,7 +64,9 @@ static size_t s_time = TIME;
 static size_t s_dim = DIM;
 static char* gram_so_file = NULL;
 static char* gram_lua_file = NULL;
-static float** s_data = NULL;
+/// the samples being evaluated, swapped with `s_shown.series` once they all are
+static GramSeries s_series = { 0 };
+static GramSeriesLayout s_layout = GRAM_SERIES_ROWS;
 static float s_min = 0;
 static float s_max = 0;
 static float s_min_v = 0;
@@ -56,33 +77,116 @@ static float s_colw = 0;
 static float s_col_w_marg = 0;
 static float s_plot_center_off = 0;
 static const GramColorScheme* s_cscheme = &GRAM_DEFAULT_CSCHEME;
+static int s_follow = 0;
+/// `GRAM_FLAG_*` of the loaded plugin
+static int s_flags = 0;
+/// threads evaluating pure plugins, the pool is started when it is first needed
+static size_t s_threads = 1;
+static GramPool* s_pool = NULL;
+static double s_polled_at = 0;
+static int s_reload = 0;
+
+/// what is drawn, the outcome of the last evaluation that was done. It is copied out of
+/// the plugin, which the next job may unload while it is still on screen
+typedef struct {
+    GramSeries series;
+    int draw_type;
+    GramColor* colors;
+    size_t colors_sz;
+    /// 0 until a plugin that can be evaluated was
+    int valid;
+    /// id of the job that evaluated the samples
+    size_t job;
+} shown_t;
+
+static shown_t s_shown = { 0 };
+/// what is drawn this frame, the samples of the running reload once the first ones are ready
+static shown_t s_view = { 0 };
+
+/// the samples of `s_view` folded into the range of every dimension in every pixel column as
+/// they get ready. Plots with more samples than columns are drawn from it, which takes as
+/// long for any number of samples
+typedef struct {
+    /// `min[c * dim + d]`, columns nothing was folded into yet have `min > max`
+    float* min;
+    float* max;
+    size_t cap;
+    size_t columns;
+    size_t dim;
+    size_t time;
+    /// id of the job the samples come from and how many of them were folded in
+    size_t job;
+    size_t folded;
+    /// range of the folded samples and 0
+    float min_v;
+    float max_v;
+} envelope_t;
+
+static envelope_t s_env = { 0 };
+
+typedef enum {
+    /// loads the plugin again and evaluates every sample
+    JOB_RELOAD,
+    /// picks up data appended to followed files
+    JOB_FOLLOW,
+} job_kind_t;
+
+/// work done on a thread of its own so the window keeps being drawn. While it runs it owns
+/// the plugin, `s_series` and the globals describing them, the render thread only touches
+/// the fields read with `__atomic_*` and `s_shown`
+typedef struct {
+    pthread_t thread;
+    job_kind_t kind;
+    size_t id;
+    /// render thread only, a job was started and not joined yet
+    int running;
+    double started_at;
+    /// set by the render thread to make the job stop after the batch it is at
+    int cancel;
+    int done;
+    /// samples to evaluate (0 while the plugin loads) and how many of them are
+    size_t total;
+    size_t evaluated;
+    /// samples at the start of `s_series` that are done, the plugin is loaded once there are any
+    size_t ready;
+    /// the job changed `s_series` and it is to be shown
+    int show;
+} job_t;
+
+static job_t s_job = { 0 };
 
 static GramExtFns gram_ext_fns = { 0 };
 static lua_State* lua_state = { 0 };
+/// memory of `lua_state`, rewound for every reload
+static GramLuaHeap* s_lua_heap = NULL;
 
 float absf(float x)
 {
     return x < 0 ? -x : x;
 }
 
+/// a state allocating from `s_lua_heap`, the previous one has to be closed
+static lua_State* new_lua_state(void)
+{
+    if (!s_lua_heap)
+        s_lua_heap = gram_lua_heap_new();
+    gram_lua_heap_reset(s_lua_heap);
+    lua_State* l = gram_lua_heap_state(s_lua_heap);
+    luaL_openlibs(l);
+    gram_lua_heap_watch(s_lua_heap, l);
+    return l;
+}
+
 static void load()
 {
     GramExtFns* ext = &gram_ext_fns;
     if (ext->gram_fini)
         ext->gram_fini();
-    if (s_data) {
-        for (size_t i = 0; i < s_time; i++) {
-            free(s_data[i]);
-        }
-        free(s_data);
-        s_data = NULL;
-    }
     if (gram_so_file) {
         load_from_so(gram_so_file, &gram_ext_fns);
     } else if (lua_state) {
         lua_close(lua_state);
-        lua_state = luaL_newstate();
-        luaL_openlibs(lua_state);
+        lua_state = new_lua_state();
         load_from_lua(gram_lua_file, lua_state, &gram_ext_fns);
     }
 
@@ -100,11 +204,10 @@ static void load()
 
     s_step = ext->gram_get_step ? ext->gram_get_step() : 1;
 
-    s_data = calloc(s_time, sizeof(float*));
+    s_flags = ext->gram_get_flags ? ext->gram_get_flags() : 0;
 
-    for (size_t i = 0; i < s_time; i++) {
-        s_data[i] = calloc(s_dim, sizeof(float));
-    }
+    // the buffer of the previous load is reused if it is big enough
+    gram_series_reset(&s_series, s_time, s_dim, s_layout);
 
     if (ext->gram_get_color_scheme) {
         GramColorScheme* cs = ext->gram_get_color_scheme();
@@ -115,40 +218,368 @@ static void load()
     }
 }
 
-static void update_data()
+/// evaluates the samples `from..to` with `gram_update_batch`, BATCH_SAMPLES at a time.
+/// Rows are written in place, columns go through a buffer of rows
+static void evaluate_batches(size_t from, size_t to)
 {
-    if (!gram_ext_fns.gram_update)
+    float t[BATCH_SAMPLES];
+    int rows = s_series.layout == GRAM_SERIES_ROWS;
+    float* out = rows ? NULL : malloc(BATCH_SAMPLES * s_dim * sizeof(float));
+    for (size_t i = from; i < to; i += BATCH_SAMPLES) {
+        size_t n = to - i < BATCH_SAMPLES ? to - i : BATCH_SAMPLES;
+        for (size_t k = 0; k < n; k++) {
+            t[k] = ((i + k) * s_step) + s_start_at;
+        }
+        if (rows) {
+            gram_ext_fns.gram_update_batch(t, n, gram_series_row(&s_series, i), s_dim);
+            continue;
+        }
+        for (size_t k = 0; k < n; k++) {
+            gram_series_load(&s_series, i + k, &out[k * s_dim]);
+        }
+        gram_ext_fns.gram_update_batch(t, n, out, s_dim);
+        for (size_t k = 0; k < n; k++) {
+            gram_series_store(&s_series, i + k, &out[k * s_dim]);
+        }
+    }
+    free(out);
+}
+
+/// evaluates the samples `from..to` into the series
+static void evaluate_samples(size_t from, size_t to)
+{
+    if (gram_ext_fns.gram_update_batch) {
+        evaluate_batches(from, to);
+    } else if (s_series.layout == GRAM_SERIES_ROWS) {
+        for (size_t t = from; t < to; t++) {
+            gram_ext_fns.gram_update((t * s_step) + s_start_at, gram_series_row(&s_series, t));
+        }
+    } else {
+        float row[s_dim];
+        for (size_t t = from; t < to; t++) {
+            gram_series_load(&s_series, t, row);
+            gram_ext_fns.gram_update((t * s_step) + s_start_at, row);
+            gram_series_store(&s_series, t, row);
+        }
+    }
+}
+
+/// evaluates the samples `from..to` a batch at a time, stops early if the job is cancelled
+static void evaluate(size_t from, size_t to)
+{
+    for (size_t i = from; i < to && !__atomic_load_n(&s_job.cancel, __ATOMIC_RELAXED); i += BATCH_SAMPLES) {
+        size_t n = to - i < BATCH_SAMPLES ? to - i : BATCH_SAMPLES;
+        evaluate_samples(i, i + n);
+        __atomic_fetch_add(&s_job.evaluated, n, __ATOMIC_RELAXED);
+    }
+}
+
+/// samples `from..to` split into `tasks` parts, each with its own range
+typedef struct {
+    size_t from;
+    size_t to;
+    size_t tasks;
+    float* min;
+    float* max;
+} parallel_job_t;
+
+static void evaluate_task(void* arg, size_t task, size_t worker)
+{
+    if (gram_ext_fns.gram_bind_worker)
+        gram_ext_fns.gram_bind_worker(worker);
+    parallel_job_t* job = arg;
+    size_t n = job->to - job->from;
+    size_t from = job->from + n * task / job->tasks;
+    size_t to = job->from + n * (task + 1) / job->tasks;
+    evaluate(from, to);
+    gram_series_range(&s_series, from, to, &job->min[task], &job->max[task]);
+}
+
+/// evaluates the samples `from..to` over the pool, returns 0 if they have to be evaluated serially
+static int evaluate_parallel(size_t from, size_t to)
+{
+    if (!(s_flags & GRAM_FLAG_PURE) || s_threads < 2 || to - from < PARALLEL_MIN_SAMPLES)
+        return 0;
+    if (!s_pool)
+        s_pool = gram_pool_new(s_threads);
+    if (!s_pool)
+        return 0;
+    if (gram_ext_fns.gram_prepare_workers && !gram_ext_fns.gram_prepare_workers(gram_pool_threads(s_pool)))
+        return 0;
+    // a few parts per thread even out parts that take longer, none smaller than a batch
+    size_t tasks = gram_pool_threads(s_pool) * TASKS_PER_THREAD;
+    size_t most = (to - from + BATCH_SAMPLES - 1) / BATCH_SAMPLES;
+    tasks = tasks < most ? tasks : most;
+    float min[tasks], max[tasks];
+    for (size_t i = 0; i < tasks; i++) {
+        min[i] = s_min_v;
+        max[i] = s_max_v;
+    }
+    parallel_job_t job = { .from = from, .to = to, .tasks = tasks, .min = min, .max = max };
+    gram_pool_run(s_pool, tasks, evaluate_task, &job);
+    for (size_t i = 0; i < tasks; i++) {
+        s_min_v = fmin(min[i], s_min_v);
+        s_max_v = fmax(max[i], s_max_v);
+    }
+    return 1;
+}
+
+/// scripts make a lot of short lived garbage while they are evaluated (a table per sample for
+/// `Update`), which the generational collector takes care of in cheap young collections
+static void lua_evaluation_begin(GramLuaHeapStats* before)
+{
+    if (!lua_state)
         return;
-    s_min = 0;
-    s_max = 0;
+    gram_lua_heap_stats(s_lua_heap, before);
+#ifdef LUA_GCGEN
+    lua_gc(lua_state, LUA_GCGEN, 0, 0);
+#endif
+}
+
+/// collects what the evaluation of `samples` samples left behind in one go and reports
+/// how much the script allocated
+static void lua_evaluation_end(const GramLuaHeapStats* before, size_t samples)
+{
+    if (!lua_state)
+        return;
+#ifdef LUA_GCINC
+    lua_gc(lua_state, LUA_GCINC, 0, 0, 0);
+#endif
+    lua_gc(lua_state, LUA_GCCOLLECT, 0);
+    GramLuaHeapStats after;
+    gram_lua_heap_stats(s_lua_heap, &after);
+    // only whole evaluations are worth a line, followed files are evaluated a few samples at a time
+    TraceLog(samples == s_time ? LOG_INFO : LOG_DEBUG,
+        "LUA: %zu samples made %zu allocations (%zu pooled) and %zu collections, %zu KiB in use, %zu KiB at most",
+        samples, after.allocs - before->allocs, after.pooled - before->pooled,
+        after.collections - before->collections, after.bytes / 1024, after.peak_bytes / 1024);
+}
 
-    for (int t = 0; t < (int)s_time; t++) {
-        gram_ext_fns.gram_update((t * s_step) + s_start_at, s_data[t]);
+/// evaluates the samples `from..s_time`, the earlier ones are kept and only widen the range
+static void update_samples(size_t from)
+{
+    if (!gram_ext_fns.gram_update)
+        return;
+    if (from == 0) {
+        s_min_v = 0;
+        s_max_v = 0;
+    }
 
-        for (size_t d = 0; d < s_dim; d++) {
-            s_min = fmin(s_data[t][d], s_min);
-            s_max = fmax(s_data[t][d], s_max);
+    __atomic_store_n(&s_job.evaluated, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s_job.total, s_time - from, __ATOMIC_RELAXED);
+    GramLuaHeapStats lua_stats;
+    lua_evaluation_begin(&lua_stats);
+    // evaluated a slice at a time, so the samples before the end of the last slice can be drawn
+    // while the rest are not yet. Pure plugins evaluate a slice out of order on several threads,
+    // the others in order on this one
+    size_t slice = BATCH_SAMPLES;
+    if ((s_flags & GRAM_FLAG_PURE) && s_threads > 1)
+        slice = s_threads * TASKS_PER_THREAD * BATCH_SAMPLES;
+    for (size_t i = from; i < s_time; i += slice) {
+        size_t to = s_time - i < slice ? s_time : i + slice;
+        if (!evaluate_parallel(i, to)) {
+            evaluate(i, to);
+            gram_series_range(&s_series, i, to, &s_min_v, &s_max_v);
         }
+        if (__atomic_load_n(&s_job.cancel, __ATOMIC_RELAXED))
+            break;
+        __atomic_store_n(&s_job.ready, to, __ATOMIC_RELEASE);
+    }
+    lua_evaluation_end(&lua_stats, s_time - from);
+}
+
+static void update_data()
+{
+    update_samples(0);
+}
+
+/// picks up data appended to followed files, only samples past the old end are evaluated.
+/// Returns 0 if there was none
+static int follow()
+{
+    GramExtFns* ext = &gram_ext_fns;
+    if (!ext->gram_poll())
+        return 0;
+    size_t time = ext->gram_get_time ? ext->gram_get_time() : TIME;
+    if (time <= s_time) {
+        // the new data did not add samples, but may change the ones there are
+        s_time = time;
+        gram_series_reset(&s_series, s_time, s_dim, s_layout);
+        update_data();
+        return 1;
     }
-    s_max_v = s_max;
-    s_min_v = s_min;
-    s_min *= 1.05;
-    s_max *= 1.05;
+    // `s_series` still holds what was shown before the last swap, the samples that are
+    // kept come from the ones shown now
+    gram_series_copy(&s_series, &s_shown.series);
+    gram_series_set_time(&s_series, time);
+    size_t from = s_time;
+    s_time = time;
+    update_samples(from);
+    return 1;
+}
+
+static void* run_job(void* arg)
+{
+    job_t* job = arg;
+    int changed = 1;
+    if (job->kind == JOB_RELOAD) {
+        load();
+        update_data();
+    } else {
+        changed = follow();
+    }
+    job->show = changed && !__atomic_load_n(&job->cancel, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/// scale of the plot for the range of the drawn samples and the size of the window
+static void update_scale()
+{
+    s_min = s_env.min_v * 1.05;
+    s_max = s_env.max_v * 1.05;
     s_full = s_max - s_min;
-    s_colw = ((float)s_plot_w) / s_time;
+    s_colw = ((float)s_plot_w) / s_view.series.time;
     s_col_w_marg = (s_colw * COL_MARGIN_PERCENT) / 2.;
     s_plot_center_off = (absf(s_min) / s_full) * s_plot_h;
 }
 
+/// swaps in the samples the job evaluated, the job has to be done
+static void show_job()
+{
+    GramSeries shown = s_shown.series;
+    s_shown.series = s_series;
+    s_series = shown;
+    s_shown.draw_type = s_draw_type;
+    s_shown.valid = gram_ext_fns.gram_update != NULL;
+    s_shown.job = s_job.id;
+    if (s_cscheme->colors_sz > s_shown.colors_sz)
+        s_shown.colors = realloc(s_shown.colors, s_cscheme->colors_sz * sizeof(GramColor));
+    memcpy(s_shown.colors, s_cscheme->colors, s_cscheme->colors_sz * sizeof(GramColor));
+    s_shown.colors_sz = s_cscheme->colors_sz;
+}
+
+static void start_job(job_kind_t kind)
+{
+    s_job.kind = kind;
+    s_job.id++;
+    s_job.started_at = GetTime();
+    s_job.cancel = 0;
+    s_job.done = 0;
+    s_job.total = 0;
+    s_job.evaluated = 0;
+    s_job.ready = 0;
+    if (pthread_create(&s_job.thread, NULL, run_job, &s_job)) {
+        TraceLog(LOG_WARNING, "Could not start a thread to evaluate on, the window freezes until it is done");
+        run_job(&s_job);
+        if (s_job.show)
+            show_job();
+        return;
+    }
+    s_job.running = 1;
+}
+
+/// shows what the job evaluated once it is done, returns 0 while it still runs
+static int finish_job()
+{
+    if (!s_job.running)
+        return 1;
+    if (!__atomic_load_n(&s_job.done, __ATOMIC_ACQUIRE))
+        return 0;
+    pthread_join(s_job.thread, NULL);
+    s_job.running = 0;
+    if (s_job.show)
+        show_job();
+    return 1;
+}
+
+/// makes the job stop early and waits for it
+static void cancel_job()
+{
+    if (!s_job.running)
+        return;
+    __atomic_store_n(&s_job.cancel, 1, __ATOMIC_RELAXED);
+    pthread_join(s_job.thread, NULL);
+    s_job.running = 0;
+}
+
 static void update_window_size_data()
 {
     s_plot_h = s_height * (1 - EXTERNAL_MARGIN_PERCENT);
     s_plot_w = s_width * (1 - EXTERNAL_MARGIN_PERCENT);
     s_plot_external_margin_w = s_width * EXTERNAL_MARGIN_PERCENT / 2.;
     s_plot_external_margin_h = s_height * EXTERNAL_MARGIN_PERCENT / 2.;
-    s_colw = ((float)s_plot_w) / s_time;
-    s_col_w_marg = (s_colw * COL_MARGIN_PERCENT) / 2.;
-    s_plot_center_off = (absf(s_min) / s_full) * s_plot_h;
+}
+
+/// starts folding the samples of `s_view` into columns from scratch
+static void envelope_reset(size_t job, size_t columns)
+{
+    size_t dim = s_view.series.dim;
+    if (columns * dim > s_env.cap) {
+        s_env.cap = columns * dim;
+        s_env.min = realloc(s_env.min, s_env.cap * sizeof(float));
+        s_env.max = realloc(s_env.max, s_env.cap * sizeof(float));
+    }
+    for (size_t i = 0; i < columns * dim; i++) {
+        s_env.min[i] = INFINITY;
+        s_env.max[i] = -INFINITY;
+    }
+    s_env.columns = columns;
+    s_env.dim = dim;
+    s_env.time = s_view.series.time;
+    s_env.job = job;
+    s_env.folded = 0;
+}
+
+/// folds the samples of `s_view` that got ready since the last frame into the envelope, for
+/// no longer than FRAME_BUDGET. The ones left are folded in over the next frames
+static void envelope_fold(size_t ready)
+{
+    size_t before = s_env.folded;
+    double start = GetTime();
+    while (s_env.folded < ready && GetTime() - start < FRAME_BUDGET) {
+        size_t to = ready - s_env.folded < FOLD_SAMPLES ? ready : s_env.folded + FOLD_SAMPLES;
+        gram_series_envelope(&s_view.series, s_env.folded, to, s_env.columns, s_env.min, s_env.max);
+        s_env.folded = to;
+    }
+    if (before == s_env.folded && before)
+        return;
+    s_env.min_v = 0;
+    s_env.max_v = 0;
+    for (size_t i = 0; i < s_env.columns * s_env.dim; i++) {
+        s_env.min_v = fmin(s_env.min[i], s_env.min_v);
+        s_env.max_v = fmax(s_env.max[i], s_env.max_v);
+    }
+}
+
+/// picks what to draw this frame: the samples of the running reload as far as they are ready,
+/// so long evaluations can be looked at from their first slice on, the shown ones otherwise
+static void update_plot()
+{
+    size_t ready = 0;
+    if (s_job.running && s_job.kind == JOB_RELOAD)
+        ready = __atomic_load_n(&s_job.ready, __ATOMIC_ACQUIRE);
+    size_t job = s_shown.job;
+    if (ready) {
+        // loaded before the first samples were ready and left alone from then on
+        s_view = (shown_t) {
+            .series = s_series,
+            .draw_type = s_draw_type,
+            .colors = s_cscheme->colors,
+            .colors_sz = s_cscheme->colors_sz,
+            .valid = 1,
+            .job = s_job.id,
+        };
+        job = s_job.id;
+    } else {
+        s_view = s_shown;
+        ready = s_shown.series.time;
+    }
+    size_t columns = s_plot_w < s_view.series.time ? (size_t)s_plot_w : s_view.series.time;
+    if (s_env.job != job || s_env.columns != columns || s_env.dim != s_view.series.dim || s_env.time != s_view.series.time)
+        envelope_reset(job, columns);
+    envelope_fold(ready);
+    update_scale();
 }
 
 static void update()
@@ -160,9 +591,22 @@ static void update()
     }
     if (IsKeyReleased(KEY_R)) {
         TraceLog(LOG_INFO, "RELOADING");
-        load();
-        update_data();
+        s_reload = 1;
+        // the samples it was after are outdated, the reload starts as soon as it stopped
+        if (s_job.running)
+            __atomic_store_n(&s_job.cancel, 1, __ATOMIC_RELAXED);
     }
+    // the previous samples stay on screen until a reload has some of the next ones ready, or a follow is done
+    if (finish_job()) {
+        if (s_reload) {
+            s_reload = 0;
+            start_job(JOB_RELOAD);
+        } else if (s_follow && gram_ext_fns.gram_poll && GetTime() - s_polled_at >= FOLLOW_INTERVAL) {
+            s_polled_at = GetTime();
+            start_job(JOB_FOLLOW);
+        }
+    }
+    update_plot();
 }
 
 static void draw_data_point(Vector2 at, double val)
@@ -187,22 +631,20 @@ static void draw_data_point(Vector2 at, double val)
     DrawTextEx(GetFontDefault(), buf, pos, 10, 10, WHITE);
 }
 
-static void draw_data()
+/// draws every sample folded into the envelope, the value under the mouse goes to `data_point`
+static void draw_samples(Vector2 mouse, double* data_point)
 {
-    Vector2 prev_c[s_dim];
-    Vector2 mouse = GetMousePosition();
-
-    // NAN if no data point to draw
-    double data_point = NAN;
+    const GramSeries* series = &s_view.series;
+    Vector2 prev_c[series->dim];
 
-    for (size_t i = 0; i < s_time; i++) {
-        for (size_t d = 0; d < s_dim; d++) {
-            float v = s_data[i][d];
+    for (size_t i = 0; i < s_env.folded; i++) {
+        for (size_t d = 0; d < series->dim; d++) {
+            float v = gram_series_get(series, i, d);
             float screen_h = (v / s_full) * s_plot_h;
             float adjust = v > 0 ? screen_h : 0;
-            GramColor color = s_cscheme->colors[d % s_cscheme->colors_sz];
+            GramColor color = s_view.colors[d % s_view.colors_sz];
 
-            switch (s_draw_type) {
+            switch (s_view.draw_type) {
             case GRAM_DRAW_RECT: {
                 Rectangle r = {
                     .x = (0 + (i * s_colw) + s_col_w_marg) + s_plot_external_margin_w,
@@ -211,10 +653,10 @@ static void draw_data()
                     .height = absf(screen_h),
                 };
                 DrawRectangleRec(r, (Color) { color.r, color.g, color.b, color.a });
-                data_point = CheckCollisionPointRec(mouse, r) ? v : data_point;
+                *data_point = CheckCollisionPointRec(mouse, r) ? v : *data_point;
             } break;
             case GRAM_DRAW_COL: {
-                float w = (s_colw - s_col_w_marg * 2) / s_dim;
+                float w = (s_colw - s_col_w_marg * 2) / series->dim;
                 Rectangle r = {
                     .x = (0 + (i * s_colw) + s_col_w_marg) + s_plot_external_margin_w + (d * w),
                     .y = (s_plot_h - s_plot_center_off - adjust) + s_plot_external_margin_h,
@@ -222,7 +664,7 @@ static void draw_data()
                     .height = absf(screen_h),
                 };
                 DrawRectangleRec(r, (Color) { color.r, color.g, color.b, color.a });
-                data_point = CheckCollisionPointRec(mouse, r) ? v : data_point;
+                *data_point = CheckCollisionPointRec(mouse, r) ? v : *data_point;
             } break;
             case GRAM_DRAW_LINE: {
                 Vector2 center = {
@@ -234,11 +676,73 @@ static void draw_data()
                     DrawLineV(prev_c[d], center, (Color) { color.r, color.g, color.b, color.a });
                 }
                 prev_c[d] = center;
-                data_point = Vector2Distance(mouse, center) <= 8 ? v : data_point;
+                *data_point = Vector2Distance(mouse, center) <= 8 ? v : *data_point;
             } break;
             }
         }
     }
+}
+
+/// draws the range of the samples in every column of the envelope, the value under the mouse
+/// goes to `data_point`
+static void draw_envelope(Vector2 mouse, double* data_point)
+{
+    size_t dim = s_env.dim;
+    float w = s_plot_w / s_env.columns;
+    float zero = s_plot_h - s_plot_center_off + s_plot_external_margin_h;
+    for (size_t c = 0; c < s_env.columns; c++) {
+        float x = (c * w) + s_plot_external_margin_w;
+        for (size_t d = 0; d < dim; d++) {
+            float lo = s_env.min[c * dim + d];
+            float hi = s_env.max[c * dim + d];
+            if (lo > hi)
+                continue;
+            GramColor gc = s_view.colors[d % s_view.colors_sz];
+            Color color = { gc.r, gc.g, gc.b, gc.a };
+            if (s_view.draw_type == GRAM_DRAW_LINE) {
+                float top_v = hi;
+                float bottom_v = lo;
+                if (c && s_env.min[(c - 1) * dim + d] <= s_env.max[(c - 1) * dim + d]) {
+                    // reaching to the range of the previous column keeps the line connected
+                    top_v = fmax(hi, s_env.min[(c - 1) * dim + d]);
+                    bottom_v = fmin(lo, s_env.max[(c - 1) * dim + d]);
+                }
+                Vector2 top = { .x = x + w / 2, .y = zero - (top_v / s_full) * s_plot_h };
+                Vector2 bottom = { .x = x + w / 2, .y = zero - (bottom_v / s_full) * s_plot_h };
+                bottom.y = fmax(bottom.y, top.y + 1);
+                DrawLineV(top, bottom, color);
+                if (absf(mouse.x - top.x) <= w && mouse.y >= top.y - 8 && mouse.y <= bottom.y + 8)
+                    *data_point = mouse.y - top.y < bottom.y - mouse.y ? hi : lo;
+                continue;
+            }
+            // the bars of the samples in the column cover the ones reaching furthest up and down
+            if (hi > 0) {
+                Rectangle r = { .x = x, .y = zero - (hi / s_full) * s_plot_h, .width = w, .height = (hi / s_full) * s_plot_h };
+                DrawRectangleRec(r, color);
+                *data_point = CheckCollisionPointRec(mouse, r) ? hi : *data_point;
+            }
+            if (lo < 0) {
+                Rectangle r = { .x = x, .y = zero, .width = w, .height = (-lo / s_full) * s_plot_h };
+                DrawRectangleRec(r, color);
+                *data_point = CheckCollisionPointRec(mouse, r) ? lo : *data_point;
+            }
+        }
+    }
+}
+
+static void draw_data()
+{
+    Vector2 mouse = GetMousePosition();
+
+    // NAN if no data point to draw
+    double data_point = NAN;
+
+    // more samples than pixel columns would be drawn over each other
+    if (s_env.columns < s_view.series.time) {
+        draw_envelope(mouse, &data_point);
+    } else {
+        draw_samples(mouse, &data_point);
+    }
     // 0 line
     DrawLineV(
         (Vector2) { .x = s_plot_external_margin_w, .y = s_height - s_plot_external_margin_h - s_plot_center_off },
@@ -257,7 +761,7 @@ static void draw_plot_region()
         .height = s_height - s_plot_external_margin_h * 2
     };
     DrawRectangleRec(plot_area, BLACK);
-    if (gram_ext_fns.gram_update)
+    if (s_view.valid)
         draw_data();
 }
 
@@ -267,7 +771,7 @@ static void draw_legend_region()
 
     static const char* zero = "0";
     static char buf[128 * 2] = { 0 };
-    if (gram_ext_fns.gram_update) {
+    if (s_view.valid) {
         Vector2 sz = MeasureTextEx(GetFontDefault(), zero, 24, 10);
         Vector2 pos = {
             .x = s_plot_external_margin_w - sz.x * 1.5,
@@ -285,10 +789,40 @@ static void draw_legend_region()
     }
 }
 
+/// a bar over the plot filling up as the samples of the running job are evaluated
+static void draw_progress()
+{
+    if (!s_job.running || GetTime() - s_job.started_at < PROGRESS_DELAY)
+        return;
+    size_t total = __atomic_load_n(&s_job.total, __ATOMIC_RELAXED);
+    size_t evaluated = __atomic_load_n(&s_job.evaluated, __ATOMIC_RELAXED);
+    static char buf[128] = { 0 };
+    if (total) {
+        snprintf(buf, sizeof buf, "evaluating %zu/%zu samples, R to restart", evaluated, total);
+    } else {
+        snprintf(buf, sizeof buf, "loading, R to restart");
+    }
+    Vector2 pos = {
+        .x = s_plot_external_margin_w,
+        .y = s_plot_external_margin_h * 0.2,
+    };
+    DrawTextEx(GetFontDefault(), buf, pos, 10, 1, DARKGRAY);
+    Rectangle bar = {
+        .x = s_plot_external_margin_w,
+        .y = s_plot_external_margin_h * 0.6,
+        .width = s_width - s_plot_external_margin_w * 2,
+        .height = s_plot_external_margin_h * 0.2,
+    };
+    DrawRectangleRec(bar, LIGHTGRAY);
+    bar.width *= total ? (float)evaluated / total : 0;
+    DrawRectangleRec(bar, DARKBLUE);
+}
+
 static void draw()
 {
     draw_legend_region();
     draw_plot_region();
+    draw_progress();
 }
 
 int main(int argc, char** args)
@@ -297,11 +831,25 @@ int main(int argc, char** args)
     plap_program_desc(&d, "gram", "simple graphing utility");
     plap_option_string(&d, "s", "so", "run the program with a shared object file", 1);
     plap_option_string(&d, "l", "lua", "run the program with a lua script", 1);
+    plap_option_int(&d, "f", "follow", "keep plotting rows appended to followed csv files", 0);
+    plap_option_string(&d, "j", "threads", "threads evaluating pure plugins and scripts (default: one per core)", 1);
+    plap_option_string(&d, "L", "layout", "sample storage, `rows` (default) or `columns` (an array per dimension)", 1);
     plap_fail_on_no_args((&d));
     Args a = plap_parse_args(d, argc, args);
 
     Option* so = plap_get_option(&a, "s", "so");
     Option* lua = plap_get_option(&a, "l", "lua");
+    s_follow = plap_get_option(&a, "f", "follow") != NULL;
+    Option* threads = plap_get_option(&a, "j", "threads");
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    s_threads = threads ? strtoul(threads->str, NULL, 10) : cores > 0 ? (size_t)cores : 1;
+    Option* layout = plap_get_option(&a, "L", "layout");
+    if (layout && strcmp(layout->str, "columns") == 0) {
+        s_layout = GRAM_SERIES_COLUMNS;
+    } else if (layout && strcmp(layout->str, "rows") != 0) {
+        fprintf(stderr, "Unknown layout `%s` (expected rows or columns)\n", layout->str);
+        exit(-1);
+    }
     if (so && lua) {
         fprintf(stderr, "Conflicting options `lua` and `so` (only one permitted)\n");
         exit(-1);
@@ -309,18 +857,15 @@ int main(int argc, char** args)
         gram_so_file = so->str;
     } else if (lua) {
         gram_lua_file = lua->str;
-        lua_state = luaL_newstate();
-        luaL_openlibs(lua_state);
+        lua_state = new_lua_state();
     }
     InitWindow(s_width, s_height, "gram");
     SetTargetFPS(60);
     SetWindowState(FLAG_WINDOW_RESIZABLE);
     SetWindowMinSize(s_width, s_height);
 
-    load();
     update_window_size_data();
-    update();
-    update_data();
+    start_job(JOB_RELOAD);
     while (!WindowShouldClose()) {
         update();
         BeginDrawing();
@@ -328,10 +873,18 @@ int main(int argc, char** args)
         draw();
         EndDrawing();
     }
+    cancel_job();
     if (gram_ext_fns.lib)
         dlclose(gram_ext_fns.lib);
     if (lua_state)
         lua_close(lua_state);
+    gram_lua_heap_free(s_lua_heap);
+    gram_series_free(&s_series);
+    gram_series_free(&s_shown.series);
+    free(s_shown.colors);
+    free(s_env.min);
+    free(s_env.max);
+    gram_pool_free(s_pool);
     CloseWindow();
 
     plap_free_args(a);